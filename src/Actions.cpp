@@ -0,0 +1,248 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Actions.hh"
+#include <sstream>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+trans::Action::Action() : transformation(NULL), args(NULL) {
+}
+
+bool
+trans::parseActions(const bplus::List& transList, ActionList& actions, std::string& oError) {
+    actions.clear();
+    for (unsigned int i = 0; i < transList.size(); i++) {
+        const bplus::Object* o = transList.value(i);
+        std::string command;
+        const bplus::Object* args = NULL;
+        // o may either be a string transformation: i.e. "solarize"
+        // or a may transform: i.e. { "crop": { .25, .75, .25, .75 } }
+        // first we'll extract the command
+        if (o->type() == BPTString) {
+            command = (std::string)(*o);
+        } else if (o->type() == BPTMap) {
+            const bplus::Map* m = (const bplus::Map*)o;
+            if (m->size() != 1) {
+                std::stringstream ss;
+                ss << "transform " << i << " is malformed.  An action is  "
+                   << "an object with a single property which is the action "
+                   << "name";
+                oError = ss.str();
+                return false;
+            }
+            bplus::Map::Iterator i(*m);
+            command.append(i.nextKey());
+            args = m->get(command.c_str());
+            assert(args != NULL);
+        } else {
+            std::stringstream ss;
+            ss << "transform " << i << " is malformed.  An action is  "
+               << "either a string or an object with a single property which "
+               << "is the name of an action to perform";
+            oError = ss.str();
+            return false;
+        }
+        // does the command exist?
+        const Transformation* t = get(command);
+        if (t == NULL) {
+            std::stringstream ss;
+            ss << "no such transformation: " << command;
+            oError = ss.str();
+            return false;
+        }
+        // are the arguments correct?
+        if (t->requiresArgs && !args) {
+            oError.append(command);
+            oError.append(" missing required argument");
+            return false;
+        }
+        if (!t->acceptsArgs && args) {
+            oError.append(command);
+            oError.append(" doesn't accept arguments");
+            return false;
+        }
+        Action a;
+        a.transformation = t;
+        a.args = args;
+        actions.push_back(a);
+    }
+    return true;
+}
+
+static bool
+isAction(const trans::Action& a, const char* name) {
+    return !strcmp(a.transformation->name, name);
+}
+
+static bool
+isScaling(const trans::Action& a) {
+    return isAction(a, "scale") || isAction(a, "thumbnail");
+}
+
+static bool
+isQuarterTurns(double degrees) {
+    return fmod(degrees, 90.0) == 0.0;
+}
+
+// GraphicsMagick rotates by whole quarter turns exactly, then shears by
+// whatever angle remains after it normalizes the angle into [-45, 45].
+// This is that remaining shear, computed the same way.
+static double
+rotationShear(double degrees) {
+    while (degrees < -45.0) {
+        degrees += 360.0;
+    }
+    while (degrees > 45.0) {
+        degrees -= 90.0;
+    }
+    return degrees;
+}
+
+static void
+foldRotations(trans::ActionList& actions) {
+    trans::ActionList out;
+    for (unsigned int i = 0; i < actions.size(); i++) {
+        double degrees;
+        std::string err;
+        if (!isAction(actions[i], "rotate") || !trans::rotationDegrees(actions[i].args, degrees, err)) {
+            out.push_back(actions[i]);
+            continue;
+        }
+        // a quarter turn followed by another rotation is a single
+        // rotation by the sum, so long as the sum leaves the very same
+        // shear.  At the +/-45 degree boundary (-90 then 45, say) or
+        // where the sum rounds it doesn't, and we leave them apart (as we
+        // do huge angles, which GraphicsMagick would normalize forever).
+        unsigned int folded = 1;
+        double next;
+        while (isQuarterTurns(degrees) && i + 1 < actions.size() &&
+               isAction(actions[i + 1], "rotate") &&
+               trans::rotationDegrees(actions[i + 1].args, next, err) &&
+               fabs(degrees) < 3600.0 && fabs(next) < 3600.0 &&
+               rotationShear(degrees + next) == rotationShear(next)) {
+            degrees += next;
+            folded++;
+            i++;
+        }
+        if (isQuarterTurns(degrees) && fmod(degrees, 360.0) == 0.0) {
+            // a full turn (or none at all)
+            continue;
+        }
+        if (folded == 1) {
+            out.push_back(actions[i]);
+            continue;
+        }
+        trans::Action a = actions[i];
+        a.ownedArgs.reset(new bplus::Double(degrees));
+        a.args = a.ownedArgs.get();
+        out.push_back(a);
+    }
+    actions.swap(out);
+}
+
+// does a bound contain another, where a bound <= 0 means unconstrained?
+static bool
+boundContains(int outer, int inner) {
+    return outer <= 0 || (inner > 0 && outer >= inner);
+}
+
+// a scale or thumbnail straight after another of the same kind whose
+// bounds contain the first's leaves the size alone, and a resize to the
+// same size is a copy, so it's dropped.  Any other pair is left be:
+// each resize truncates its size, so a single resize to the tighter
+// bounds can differ by a pixel, and a thumbnail samples and filters
+// differently from a scale.
+static void
+collapseScaling(trans::ActionList& actions) {
+    trans::ActionList out;
+    for (unsigned int i = 0; i < actions.size(); i++) {
+        int maxwidth;
+        int maxheight;
+        bool draft;
+        std::string err;
+        out.push_back(actions[i]);
+        if (!isScaling(actions[i]) ||
+            !trans::scalingBounds(actions[i].transformation->name, actions[i].args,
+                                  maxwidth, maxheight, draft, err)) {
+            continue;
+        }
+        int w;
+        int h;
+        bool d;
+        while (i + 1 < actions.size() &&
+               isAction(actions[i + 1], actions[i].transformation->name) &&
+               trans::scalingBounds(actions[i + 1].transformation->name, actions[i + 1].args,
+                                    w, h, d, err) &&
+               boundContains(w, maxwidth) && boundContains(h, maxheight)) {
+            i++;
+        }
+    }
+    actions.swap(out);
+}
+
+// a crop selects the same pixels whether or not a pixel-local action
+// ran first, so crop first and give the pixel-local actions less to do
+static void
+hoistCrops(trans::ActionList& actions) {
+    for (unsigned int i = 1; i < actions.size(); i++) {
+        if (!isAction(actions[i], "crop")) {
+            continue;
+        }
+        for (unsigned int j = i; j > 0 && actions[j - 1].transformation->pointOp; j--) {
+            std::swap(actions[j - 1], actions[j]);
+        }
+    }
+}
+
+void
+trans::optimizeActions(ActionList& actions) {
+    // every action keeps only the first frame of an animation, so if
+    // everything cancels out a single noop must remain to do that
+    Action noop;
+    noop.transformation = get("noop");
+    bool requested = !actions.empty();
+    ActionList out;
+    for (unsigned int i = 0; i < actions.size(); i++) {
+        if (!isAction(actions[i], "noop")) {
+            out.push_back(actions[i]);
+        }
+    }
+    actions.swap(out);
+    foldRotations(actions);
+    collapseScaling(actions);
+    hoistCrops(actions);
+    if (requested && actions.empty()) {
+        actions.push_back(noop);
+    }
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Parsing, validation and optimization of the list of actions a
+ * client asks us to perform.
+ */
+
+#ifndef __ACTIONS_HH__
+#define __ACTIONS_HH__
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "bpservice/bpservice.h"
+#include "Transformations.hh"
+
+namespace trans {
+    /** a single validated action */
+    struct Action {
+        Action();
+        // the transformation to perform
+        const Transformation* transformation;
+        // its arguments, or NULL
+        const bplus::Object* args;
+        // holds arguments which were synthesized by optimizeActions
+        boost::shared_ptr<bplus::Object> ownedArgs;
+    };
+    typedef std::vector<Action> ActionList;
+    /** parse a client supplied list of actions, checking that every
+     *  action exists and is given arguments only where it accepts them.
+     *  args in the result point into transList, which must outlive it */
+    bool parseActions(const bplus::List& transList, ActionList& actions, std::string& oError);
+    /** rewrite actions into an equivalent list that's cheaper to run:
+     *   - noops are removed
+     *   - consecutive rotations are folded into one when that's exact,
+     *     and rotations by multiples of 360 degrees are removed
+     *   - a scale or thumbnail straight after one of the same kind is
+     *     removed when its bounds contain the first's, so it can't
+     *     change the size
+     *   - crops are moved ahead of the pixel-local actions preceding them */
+    void optimizeActions(ActionList& actions);
+};
+
+#endif
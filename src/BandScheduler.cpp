@@ -0,0 +1,422 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BandScheduler.hh"
+#include "Trace.hh"
+#include <deque>
+#include <vector>
+#include <exception>
+#include <boost/thread.hpp>
+
+// roughly how many bytes of pixels go in a band, small enough that a
+// band stays in a core's cache while the kernel runs over it
+#define BAND_BYTES (256 * 1024)
+
+// images with fewer pixels than this aren't worth waking threads for
+#define BAND_MIN_PARALLEL_PIXELS (512 * 1024)
+
+// helper threads currently running, over all images.  While several
+// images are in flight each gets fewer helpers, so the machine isn't
+// oversubscribed.
+static boost::mutex s_helpersLock;
+static unsigned int s_helpers = 0;
+static unsigned int s_concurrency = 0;
+
+namespace {
+    // work the caller shares with helper threads, which claim pieces of
+    // it one at a time until none are left
+    class HelperWork {
+    public:
+        HelperWork() : m_helpers(0) { }
+        virtual ~HelperWork() { }
+        virtual void run() = 0;
+        // n more helpers were asked to join in
+        void joining(unsigned int n) {
+            boost::mutex::scoped_lock lock(m_lock);
+            m_helpers += n;
+        }
+        // a helper is done with the work, or n never got to it.  The
+        // work may be gone as soon as the last one leaves.
+        void left(unsigned int n) {
+            boost::mutex::scoped_lock lock(m_lock);
+            m_helpers -= n;
+            if (m_helpers == 0) {
+                m_gone.notify_all();
+            }
+        }
+        void waitForHelpers() {
+            boost::mutex::scoped_lock lock(m_lock);
+            while (m_helpers > 0) {
+                m_gone.wait(lock);
+            }
+        }
+    private:
+        boost::mutex m_lock;
+        boost::condition_variable m_gone;
+        unsigned int m_helpers;
+    };
+
+    // helper threads, started as they're first needed and then kept
+    // parked for the life of the process.  Starting threads for every
+    // image would cost more than small images take to process.
+    struct HelperPool {
+        HelperPool() : threads(0), busy(0) { }
+        boost::mutex lock;
+        boost::condition_variable queued;
+        // one entry for each helper asked to join in some work
+        std::deque<HelperWork*> queue;
+        unsigned int threads;
+        unsigned int busy;
+    };
+}
+
+// never destroyed, the helpers wait on it until the process exits
+static HelperPool* s_pool = new HelperPool;
+
+static void
+helperMain() {
+    boost::mutex::scoped_lock lock(s_pool->lock);
+    for (;;) {
+        while (s_pool->queue.empty()) {
+            s_pool->queued.wait(lock);
+        }
+        HelperWork* work = s_pool->queue.front();
+        s_pool->queue.pop_front();
+        s_pool->busy++;
+        lock.unlock();
+        try {
+            work->run();
+        } catch (...) {
+            // the work records its own failures, the helper carries on
+        }
+        work->left(1);
+        lock.lock();
+        s_pool->busy--;
+    }
+}
+
+// ask n helpers to join in work, starting threads if too few are idle
+static void
+postHelpers(HelperWork& work, unsigned int n) {
+    if (n == 0) {
+        return;
+    }
+    work.joining(n);
+    boost::mutex::scoped_lock lock(s_pool->lock);
+    for (unsigned int i = 0; i < n; i++) {
+        s_pool->queue.push_back(&work);
+    }
+    try {
+        while (s_pool->threads - s_pool->busy < s_pool->queue.size()) {
+            boost::thread t(&helperMain);
+            t.detach();
+            s_pool->threads++;
+        }
+    } catch (const boost::thread_resource_error&) {
+        // carry on with the threads we have, the caller takes back
+        // whatever they don't get to
+    }
+    s_pool->queued.notify_all();
+}
+
+// take back the part of work no helper has started on, and wait for
+// those that have to finish
+static void
+recallHelpers(HelperWork& work) {
+    unsigned int unstarted = 0;
+    {
+        boost::mutex::scoped_lock lock(s_pool->lock);
+        std::deque<HelperWork*>::iterator it = s_pool->queue.begin();
+        while (it != s_pool->queue.end()) {
+            if (*it == &work) {
+                it = s_pool->queue.erase(it);
+                unstarted++;
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (unstarted > 0) {
+        work.left(unstarted);
+    }
+    work.waitForHelpers();
+}
+
+namespace {
+    struct BandJob : public HelperWork {
+        BandJob() : nextBand(0), bands(0), rowsPerBand(0) { }
+        void run();
+        imageproc::BandFunc func;
+        const void* data;
+        PixelPacket* pixels;
+        IndexPacket* indexes;
+        unsigned long columns;
+        unsigned long rows;
+        boost::mutex lock;
+        unsigned long nextBand;
+        unsigned long bands;
+        unsigned long rowsPerBand;
+    };
+}
+
+namespace {
+    struct FrameJob : public HelperWork {
+        FrameJob() : nextFrame(0) { }
+        void run();
+        imageproc::FrameFunc func;
+        const void* data;
+        // the frames to transform, each replaced by its result
+        std::vector<Image*> frames;
+        std::vector<std::string> errors;
+        boost::mutex lock;
+        size_t nextFrame;
+    };
+}
+
+// claim and run bands until there are none left
+void
+BandJob::run() {
+    IA_TRACE_SCOPE("bands");
+    for (;;) {
+        unsigned long band;
+        {
+            boost::mutex::scoped_lock l(lock);
+            if (nextBand == bands) {
+                return;
+            }
+            band = nextBand++;
+        }
+        unsigned long first = band * rowsPerBand;
+        unsigned long n = rowsPerBand;
+        if (first + n > rows) {
+            n = rows - first;
+        }
+        func(data, pixels + first * columns, indexes ? indexes + first * columns : NULL,
+             columns, first, n);
+    }
+}
+
+// claim and transform frames until there are none left
+void
+FrameJob::run() {
+    IA_TRACE_SCOPE("frames");
+    for (;;) {
+        size_t frame;
+        {
+            boost::mutex::scoped_lock l(lock);
+            if (nextFrame == frames.size()) {
+                return;
+            }
+            frame = nextFrame++;
+        }
+        try {
+            frames[frame] = func(data, frames[frame], errors[frame]);
+        } catch (const std::exception& e) {
+            frames[frame] = NULL;
+            errors[frame] = e.what();
+        }
+    }
+}
+
+static unsigned int
+concurrency() {
+    if (s_concurrency) {
+        return s_concurrency;
+    }
+    unsigned int n = boost::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// reserve up to wanted helper threads, fewer if other images hold them
+static unsigned int
+reserveHelpers(unsigned int wanted) {
+    boost::mutex::scoped_lock lock(s_helpersLock);
+    unsigned int limit = concurrency() - 1;
+    unsigned int available = s_helpers < limit ? limit - s_helpers : 0;
+    if (wanted > available) {
+        wanted = available;
+    }
+    s_helpers += wanted;
+    return wanted;
+}
+
+static void
+releaseHelpers(unsigned int n) {
+    boost::mutex::scoped_lock lock(s_helpersLock);
+    s_helpers -= n;
+}
+
+// do work with the help of up to wanted helper threads
+static void
+shareWork(HelperWork& work, unsigned int wanted) {
+    unsigned int helpers = reserveHelpers(wanted);
+    postHelpers(work, helpers);
+    try {
+        work.run();
+    } catch (...) {
+        // helpers mustn't be left working on what's about to go away
+        recallHelpers(work);
+        releaseHelpers(helpers);
+        throw;
+    }
+    recallHelpers(work);
+    releaseHelpers(helpers);
+}
+
+void
+imageproc::SetBandConcurrency(unsigned int threads) {
+    boost::mutex::scoped_lock lock(s_helpersLock);
+    s_concurrency = threads;
+}
+
+bool
+imageproc::ModifyPixelsInBands(Image* image, BandFunc func, const void* data, std::string& oError) {
+    const unsigned long columns = image->columns;
+    const unsigned long rows = image->rows;
+    if (columns == 0 || rows == 0) {
+        return true;
+    }
+    unsigned long rowsPerBand = BAND_BYTES / (columns * sizeof(PixelPacket));
+    if (rowsPerBand < 1) {
+        rowsPerBand = 1;
+    }
+    unsigned long bands = (rows + rowsPerBand - 1) / rowsPerBand;
+    PixelPacket* pixels = NULL;
+    if ((double)columns * rows >= BAND_MIN_PARALLEL_PIXELS && bands > 1) {
+        // for an in memory pixel cache this is the cache itself, not a copy
+        pixels = GetImagePixels(image, 0, 0, columns, rows);
+    }
+    if (pixels == NULL) {
+        // small image, or no room for a view of the whole thing.  Walk
+        // the bands in order on this thread.
+        for (unsigned long first = 0; first < rows; first += rowsPerBand) {
+            unsigned long n = rowsPerBand;
+            if (first + n > rows) {
+                n = rows - first;
+            }
+            PixelPacket* p = GetImagePixels(image, 0, (long)first, columns, n);
+            if (p == NULL) {
+                oError.append("couldn't access image pixels");
+                return false;
+            }
+            func(data, p, AccessMutableIndexes(image), columns, first, n);
+            if (!SyncImagePixels(image)) {
+                oError.append("couldn't store image pixels");
+                return false;
+            }
+        }
+        return true;
+    }
+    BandJob job;
+    job.func = func;
+    job.data = data;
+    job.pixels = pixels;
+    job.indexes = AccessMutableIndexes(image);
+    job.columns = columns;
+    job.rows = rows;
+    job.bands = bands;
+    job.rowsPerBand = rowsPerBand;
+    shareWork(job, (unsigned int)(bands - 1));
+    if (!SyncImagePixels(image)) {
+        oError.append("couldn't store image pixels");
+        return false;
+    }
+    return true;
+}
+
+Image*
+imageproc::TransformFrames(Image* images, FrameFunc func, const void* data, std::string& oError) {
+    // frames of an animation may only cover part of the picture, relying
+    // on the ones before.  Coalescing makes every frame whole.
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    Image* coalesced = CoalesceImages(images, &exception);
+    DestroyExceptionInfo(&exception);
+    if (coalesced == NULL) {
+        DestroyImageList(images);
+        oError.append("couldn't separate the frames of the image");
+        return NULL;
+    }
+    // playing whole frames with the original disposal shows the same
+    // animation, so that's kept along with the timing
+    std::vector<unsigned long> delays;
+    std::vector<DisposeType> disposals;
+    for (const Image* f = images; f; f = f->next) {
+        delays.push_back(f->delay);
+        disposals.push_back(f->dispose);
+    }
+    unsigned long iterations = images->iterations;
+    DestroyImageList(images);
+    FrameJob job;
+    job.func = func;
+    job.data = data;
+    while (coalesced) {
+        Image* f = coalesced;
+        coalesced = f->next;
+        f->next = NULL;
+        f->previous = NULL;
+        if (coalesced) {
+            coalesced->previous = NULL;
+        }
+        job.frames.push_back(f);
+    }
+    job.errors.resize(job.frames.size());
+    shareWork(job, (unsigned int)(job.frames.size() - 1));
+    // put the animation back together
+    Image* result = NULL;
+    for (size_t i = 0; i < job.frames.size(); i++) {
+        if (job.frames[i] == NULL) {
+            if (oError.empty()) {
+                oError.append(job.errors[i].empty() ? "couldn't transform a frame" : job.errors[i]);
+            }
+            continue;
+        }
+        Image* f = job.frames[i];
+        if (i < delays.size()) {
+            f->delay = delays[i];
+            f->dispose = disposals[i];
+        }
+        f->iterations = iterations;
+        f->page.width = f->columns;
+        f->page.height = f->rows;
+        f->page.x = 0;
+        f->page.y = 0;
+        AppendImageToList(&result, f);
+    }
+    if (!oError.empty()) {
+        if (result) {
+            DestroyImageList(result);
+        }
+        return NULL;
+    }
+    return result;
+}
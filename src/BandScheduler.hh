@@ -0,0 +1,78 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs a pixel kernel over an image in bands of rows, or a
+ * transformation over the frames of an animation, spread across the
+ * cores of the machine.
+ */
+
+#ifndef __BANDSCHEDULER_HH__
+#define __BANDSCHEDULER_HH__
+
+#include <string>
+#include <magick/api.h>
+
+namespace imageproc {
+    /** modify rows of pixels in place.  pixels and indexes (which may be
+     *  NULL) point at the first of rows rows of columns pixels, starting
+     *  at row firstRow of the image.  Called concurrently on disjoint
+     *  bands, so it mustn't touch state other bands touch. */
+    typedef void (*BandFunc)(const void* data, PixelPacket* pixels, IndexPacket* indexes,
+                             unsigned long columns, unsigned long firstRow, unsigned long rows);
+    /** run func over every pixel of image.  Large images are cut into
+     *  bands of rows which helper threads claim one at a time until none
+     *  are left, the calling thread working alongside them.  The
+     *  helpers are started once and kept for the life of the process.  Since each
+     *  pixel is visited exactly once the result is the same as a single
+     *  pass however the bands fall. */
+    bool ModifyPixelsInBands(Image* image, BandFunc func, const void* data, std::string& oError);
+    /** transform a single frame, taking ownership of it.  Returns the
+     *  result, or NULL with oError populated.  Called concurrently on
+     *  different frames. */
+    typedef Image* (*FrameFunc)(const void* data, Image* frame, std::string& oError);
+    /** run func over every frame of images, which it takes ownership
+     *  of.  The frames are first coalesced so each is a complete
+     *  picture that can be transformed on its own, then handed out to
+     *  helper threads as for ModifyPixelsInBands().  The results are
+     *  reassembled in order, keeping each frame's delay and disposal
+     *  and the loop count.
+     *  \returns the transformed list, or NULL with oError populated if
+     *           any frame failed */
+    Image* TransformFrames(Image* images, FrameFunc func, const void* data, std::string& oError);
+    /** limit the number of threads (including the caller) that a single
+     *  ModifyPixelsInBands() or TransformFrames() may use, 0 means a
+     *  thread per core */
+    void SetBandConcurrency(unsigned int threads);
+};
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A micro-benchmark of every transformation, run at several image sizes
+ * and pixel types.  Each result is printed as a line of JSON:
+ *
+ *   {"action":"blur","type":"rgb","megapixels":3.00,"width":2000,
+ *    "height":1500,"iterations":4,"seconds":1.234,"mpPerSec":9.72,
+ *    "allocations":12,"peakRssKB":123456}
+ *
+ * allocations is per iteration (-1 where it can't be counted), peakRssKB
+ * is the process' high water mark so far.
+ *
+ * usage: ImageAlterBench [--sizes 0.3,3,12,48] [--types rgb,rgba,gray,palette]
+ *                        [--actions blur,scale,...] [--min-seconds 1]
+ *                        [--resampler magick|native]
+ */
+
+#include "Transformations.hh"
+#include "PointKernel.hh"
+#include "Profile.hh"
+#include "Resample.hh"
+#include <magick/api.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// at most this many iterations of a case, however fast it is
+#define BENCH_MAX_ITERATIONS 100
+
+// the processor logs freely, the benchmark wants none of it
+void
+bplus::service::Service::log(unsigned int, const std::string&) {
+}
+
+#ifdef __GLIBC__
+// count calls to the allocator (by GraphicsMagick and us alike) by
+// interposing on glibc's
+extern "C" {
+    void* __libc_malloc(size_t);
+    void* __libc_calloc(size_t, size_t);
+    void* __libc_realloc(void*, size_t);
+}
+static volatile long s_allocations = 0;
+
+void*
+malloc(size_t n) {
+    __sync_fetch_and_add(&s_allocations, 1);
+    return __libc_malloc(n);
+}
+
+void*
+calloc(size_t n, size_t size) {
+    __sync_fetch_and_add(&s_allocations, 1);
+    return __libc_calloc(n, size);
+}
+
+void*
+realloc(void* p, size_t n) {
+    __sync_fetch_and_add(&s_allocations, 1);
+    return __libc_realloc(p, n);
+}
+
+static long
+allocations() {
+    return s_allocations;
+}
+#else
+static long
+allocations() {
+    return -1;
+}
+#endif
+
+static long
+peakRssKB() {
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return -1;
+    }
+    return (long)(pmc.PeakWorkingSetSize / 1024);
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    // bytes, rather than kilobytes
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+#endif
+}
+
+static std::vector<std::string>
+split(const std::string& s) {
+    std::vector<std::string> parts;
+    std::string::size_type start = 0;
+    while (start <= s.size()) {
+        std::string::size_type end = s.find(',', start);
+        if (end == std::string::npos) {
+            end = s.size();
+        }
+        if (end > start) {
+            parts.push_back(s.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return parts;
+}
+
+static bool
+selected(const std::vector<std::string>& names, const std::string& name) {
+    if (names.empty()) {
+        return true;
+    }
+    for (unsigned int i = 0; i < names.size(); i++) {
+        if (names[i] == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a columns x rows test image of the given type (rgb, rgba, gray or
+// palette) with some structure in every channel
+static Image*
+makeImage(const std::string& type, unsigned long columns, unsigned long rows) {
+    ImageInfo* info = CloneImageInfo((ImageInfo*)NULL);
+    Image* image = AllocateImage(info);
+    DestroyImageInfo(info);
+    if (!image) {
+        return NULL;
+    }
+    image->columns = columns;
+    image->rows = rows;
+    bool palette = type == "palette";
+    if (palette && !AllocateImageColormap(image, 256)) {
+        DestroyImage(image);
+        return NULL;
+    }
+    image->matte = type == "rgba";
+    for (unsigned long y = 0; y < rows; y++) {
+        PixelPacket* p = SetImagePixels(image, 0, y, columns, 1);
+        if (!p) {
+            DestroyImage(image);
+            return NULL;
+        }
+        IndexPacket* indexes = palette ? AccessMutableIndexes(image) : NULL;
+        for (unsigned long x = 0; x < columns; x++) {
+            unsigned int r = (unsigned int)(x * 255 / columns);
+            unsigned int g = (unsigned int)(y * 255 / rows);
+            unsigned int b = (unsigned int)((x ^ y) & 0xff);
+            if (palette) {
+                indexes[x] = (IndexPacket)((r + g + b) & 0xff);
+                p[x] = image->colormap[indexes[x]];
+                continue;
+            }
+            if (type == "gray") {
+                r = g = b = (r + g + b) / 3;
+            }
+            p[x].red = ScaleCharToQuantum(r);
+            p[x].green = ScaleCharToQuantum(g);
+            p[x].blue = ScaleCharToQuantum(b);
+            p[x].opacity = image->matte ? ScaleCharToQuantum((x + y) & 0xff) : OpaqueOpacity;
+        }
+        if (!SyncImagePixels(image)) {
+            DestroyImage(image);
+            return NULL;
+        }
+    }
+    image->is_grayscale = type == "gray";
+    return image;
+}
+
+// arguments exercising the usual path of each transformation which
+// needs them, NULL otherwise
+static bplus::Object*
+benchArgs(const trans::Transformation* t, const Image* image) {
+    std::string name(t->name);
+    if (name == "crop") {
+        bplus::List* l = new bplus::List;
+        l->append(new bplus::Double(0.1));
+        l->append(new bplus::Double(0.1));
+        l->append(new bplus::Double(0.9));
+        l->append(new bplus::Double(0.9));
+        return l;
+    } else if (name == "scale" || name == "thumbnail") {
+        bplus::Map* m = new bplus::Map;
+        m->add("maxwidth", new bplus::Integer(image->columns / 2));
+        m->add("maxheight", new bplus::Integer(image->rows / 2));
+        return m;
+    } else if (name == "rotate" || name == "swirl") {
+        return new bplus::Integer(90);
+    }
+    return NULL;
+}
+
+// run t over image once, as the service would: fused into a point
+// kernel, in place, or into a new image.  takes ownership of image.
+static bool
+runOnce(const trans::Transformation* t, const bplus::Object* args, Image* image, std::string& err) {
+    Image* out = NULL;
+    if (t->pointOp) {
+        trans::PointKernel kernel;
+        if (t->pointOp(kernel, args, err) && kernel.apply(image, err)) {
+            out = image;
+        } else {
+            DestroyImage(image);
+        }
+    } else if (t->transformInPlace) {
+        out = t->transformInPlace(image, args, 100, err);
+    } else {
+        out = t->transform(image, args, 100, err);
+        DestroyImage(image);
+    }
+    if (!out) {
+        if (err.empty()) {
+            err = "failed";
+        }
+        return false;
+    }
+    DestroyImageList(out);
+    return true;
+}
+
+static void
+runCase(const trans::Transformation* t, const std::string& type, double megapixels,
+        double minSeconds) {
+    unsigned long rows = (unsigned long)sqrt(megapixels * 1e6 * 3 / 4);
+    unsigned long columns = rows * 4 / 3;
+    std::stringstream ss;
+    ss.setf(std::ios::fixed);
+    ss.precision(2);
+    ss << "{\"action\":\"" << t->name << "\",\"type\":\"" << type
+       << "\",\"megapixels\":" << megapixels
+       << ",\"width\":" << columns << ",\"height\":" << rows;
+    Image* source = makeImage(type, columns, rows);
+    if (!source) {
+        std::cout << ss.str() << ",\"error\":\"couldn't make image\"}" << std::endl;
+        return;
+    }
+    bplus::Object* args = benchArgs(t, source);
+    double elapsed = 0.0;
+    long allocated = 0;
+    unsigned int iterations = 0;
+    std::string err;
+    while (iterations < BENCH_MAX_ITERATIONS && (iterations == 0 || elapsed < minSeconds * 1000.0)) {
+        ExceptionInfo exception;
+        GetExceptionInfo(&exception);
+        Image* image = CloneImage(source, 0, 0, 1, &exception);
+        DestroyExceptionInfo(&exception);
+        if (!image || !GetImagePixels(image, 0, 0, 1, 1)) {
+            // the copy shares pixels until written, so writing one now
+            // keeps that copy out of the timing
+            err = "couldn't copy image";
+            break;
+        }
+        long a = allocations();
+        double start = imageproc::monotonicMillis();
+        bool ok = runOnce(t, args, image, err);
+        elapsed += imageproc::monotonicMillis() - start;
+        allocated += allocations() - a;
+        if (!ok) {
+            break;
+        }
+        iterations++;
+    }
+    delete args;
+    DestroyImage(source);
+    if (!err.empty()) {
+        std::cout << ss.str() << ",\"error\":\"" << err << "\"}" << std::endl;
+        return;
+    }
+    double seconds = elapsed / 1000.0;
+    ss.precision(3);
+    ss << ",\"iterations\":" << iterations << ",\"seconds\":" << seconds
+       << ",\"mpPerSec\":" << megapixels * iterations / seconds
+       << ",\"allocations\":" << (allocations() < 0 ? -1 : allocated / (long)iterations)
+       << ",\"peakRssKB\":" << peakRssKB() << "}";
+    std::cout << ss.str() << std::endl;
+}
+
+int
+main(int argc, char** argv) {
+    std::vector<std::string> sizes = split("0.3,3,12,48");
+    std::vector<std::string> types = split("rgb,rgba,gray,palette");
+    std::vector<std::string> actions;
+    double minSeconds = 1.0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string opt(argv[i]);
+        if (opt == "--sizes") {
+            sizes = split(argv[i + 1]);
+        } else if (opt == "--types") {
+            types = split(argv[i + 1]);
+        } else if (opt == "--actions") {
+            actions = split(argv[i + 1]);
+        } else if (opt == "--min-seconds") {
+            minSeconds = atof(argv[i + 1]);
+        } else if (opt == "--resampler") {
+            trans::useNativeResampler(std::string(argv[i + 1]) == "native");
+        } else {
+            std::cerr << "unknown option " << opt << std::endl;
+            return 1;
+        }
+    }
+    InitializeMagick(argv[0]);
+    for (unsigned int s = 0; s < sizes.size(); s++) {
+        double megapixels = atof(sizes[s].c_str());
+        for (unsigned int p = 0; p < types.size(); p++) {
+            for (unsigned int i = 0; i < trans::num(); i++) {
+                const trans::Transformation* t = trans::get(i);
+                if (selected(actions, t->name)) {
+                    runCase(t, types[p], megapixels, minSeconds);
+                }
+            }
+        }
+    }
+    DestroyMagick();
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ColorMatrix.hh"
+
+#if defined(IA_X86_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define IA_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+void
+trans::colorMatrixScalar(const double matrix[3][3], PixelPacket* pixels, unsigned long n) {
+    for (unsigned long i = 0; i < n; i++) {
+        PixelPacket* p = pixels + i;
+        float r1 = (float)p->red;
+        float g1 = (float)p->green;
+        float b1 = (float)p->blue;
+        float r2 = (r1 * matrix[0][0] + g1 * matrix[0][1] + b1 * matrix[0][2]);
+        float g2 = (r1 * matrix[1][0] + g1 * matrix[1][1] + b1 * matrix[1][2]);
+        float b2 = (r1 * matrix[2][0] + g1 * matrix[2][1] + b1 * matrix[2][2]);
+        if (r2 > MaxRGB) {
+            r2 = MaxRGB;
+        } else if (r2 < 0) {
+            r2 = 0;
+        }
+        if (g2 > MaxRGB) {
+            g2 = MaxRGB;
+        } else if (g2 < 0) {
+            g2 = 0;
+        }
+        if (b2 > MaxRGB) {
+            b2 = MaxRGB;
+        } else if (b2 < 0) {
+            b2 = 0;
+        }
+        p->red = (Quantum)r2;
+        p->green = (Quantum)g2;
+        p->blue = (Quantum)b2;
+    }
+}
+
+void
+trans::applyColorMatrix(const double matrix[3][3], PixelPacket* pixels, unsigned long n) {
+    KernelRegistry<ColorMatrixKernel>::instance().best().func(matrix, pixels, n);
+}
+
+static trans::KernelRegistrar<trans::ColorMatrixKernel>
+s_scalar("scalar", 0, NULL, trans::colorMatrixScalar);
+
+// defined in ColorMatrixAVX2.cpp, but registered here to keep that file
+// free of the registry's code
+static trans::KernelRegistrar<trans::ColorMatrixKernel>
+s_avx2("avx2", 20, trans::cpuHasAVX2, trans::colorMatrixAVX2);
+
+#ifdef IA_HAVE_SSE2
+// one output channel for two pixels: m0 * r + m1 * g + m2 * b, in the
+// same order as the scalar code
+static inline __m128d
+dot(const __m128d* m, __m128d r, __m128d g, __m128d b) {
+    return _mm_add_pd(_mm_add_pd(_mm_mul_pd(r, m[0]), _mm_mul_pd(g, m[1])), _mm_mul_pd(b, m[2]));
+}
+
+// four pixels at a time.  Each pixel is a 32 bit lane with blue in
+// the low byte and opacity in the high byte.
+static void
+colorMatrixSSE2(const double matrix[3][3], PixelPacket* pixels, unsigned long n) {
+    __m128d m[3][3];
+    for (unsigned int i = 0; i < 3; i++) {
+        for (unsigned int j = 0; j < 3; j++) {
+            m[i][j] = _mm_set1_pd(matrix[i][j]);
+        }
+    }
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    const __m128i opacityMask = _mm_set1_epi32((int)0xff000000);
+    const __m128 maxRGB = _mm_set1_ps((float)MaxRGB);
+    const __m128 zero = _mm_setzero_ps();
+    unsigned long i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pixels + i));
+        __m128i b = _mm_and_si128(v, byteMask);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), byteMask);
+        __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), byteMask);
+        __m128d rl = _mm_cvtepi32_pd(r);
+        __m128d gl = _mm_cvtepi32_pd(g);
+        __m128d bl = _mm_cvtepi32_pd(b);
+        __m128d rh = _mm_cvtepi32_pd(_mm_srli_si128(r, 8));
+        __m128d gh = _mm_cvtepi32_pd(_mm_srli_si128(g, 8));
+        __m128d bh = _mm_cvtepi32_pd(_mm_srli_si128(b, 8));
+        __m128i out[3];
+        for (unsigned int c = 0; c < 3; c++) {
+            __m128 f = _mm_movelh_ps(_mm_cvtpd_ps(dot(m[c], rl, gl, bl)),
+                                     _mm_cvtpd_ps(dot(m[c], rh, gh, bh)));
+            f = _mm_max_ps(_mm_min_ps(f, maxRGB), zero);
+            out[c] = _mm_cvttps_epi32(f);
+        }
+        __m128i res = _mm_or_si128(_mm_and_si128(v, opacityMask), _mm_slli_epi32(out[0], 16));
+        res = _mm_or_si128(res, _mm_slli_epi32(out[1], 8));
+        res = _mm_or_si128(res, out[2]);
+        _mm_storeu_si128((__m128i*)(pixels + i), res);
+    }
+    trans::colorMatrixScalar(matrix, pixels + i, n - i);
+}
+
+static trans::KernelRegistrar<trans::ColorMatrixKernel>
+s_sse2("sse2", 10, trans::cpuHasSSE2, colorMatrixSSE2);
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The color matrix kernel: every pixel is replaced with a 3x3 matrix
+ * times its (r, g, b), saturated to [0, MaxRGB].  sepia is one.
+ *
+ * All implementations compute exactly what the portable one does:
+ * products and sums in double precision (with no fused multiply-add),
+ * rounded to float, clamped, then truncated.  So which one runs never
+ * changes the output.
+ */
+
+#ifndef __COLORMATRIX_HH__
+#define __COLORMATRIX_HH__
+
+#include <magick/api.h>
+#include "SIMD.hh"
+
+namespace trans {
+    /** tag for the color matrix kernel's registry */
+    struct ColorMatrixKernel {
+        typedef void (*Func)(const double matrix[3][3], PixelPacket* pixels, unsigned long n);
+    };
+    /** the portable implementation, SIMD variants use it for the pixels
+     *  left over after their last full vector */
+    void colorMatrixScalar(const double matrix[3][3], PixelPacket* pixels, unsigned long n);
+    /** apply matrix to n pixels with the best variant this CPU supports */
+    void applyColorMatrix(const double matrix[3][3], PixelPacket* pixels, unsigned long n);
+    /** the AVX2 implementation, NULL where it can't be built.  It's
+     *  registered from ColorMatrix.cpp, see SIMD.hh. */
+    extern const ColorMatrixKernel::Func colorMatrixAVX2;
+};
+
+// SIMD variants work on 8 bit quanta packed 4 bytes to a pixel
+#if QuantumDepth == 8 && (defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64))
+#define IA_X86_SIMD 1
+#endif
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The AVX2 color matrix kernel.  This file is built with AVX2 code
+ * generation enabled, so it holds nothing but the kernel (see SIMD.hh),
+ * which is only run on CPUs that support it.
+ */
+
+#include "ColorMatrix.hh"
+
+#if defined(IA_X86_SIMD) && (defined(__AVX2__) || defined(_MSC_VER))
+#include <immintrin.h>
+
+static inline __m256d
+dot(const __m256d* m, __m256d r, __m256d g, __m256d b) {
+    return _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(r, m[0]), _mm256_mul_pd(g, m[1])),
+                         _mm256_mul_pd(b, m[2]));
+}
+
+// eight pixels at a time, see colorMatrixSSE2
+static void
+colorMatrixAVX2(const double matrix[3][3], PixelPacket* pixels, unsigned long n) {
+    __m256d m[3][3];
+    for (unsigned int i = 0; i < 3; i++) {
+        for (unsigned int j = 0; j < 3; j++) {
+            m[i][j] = _mm256_set1_pd(matrix[i][j]);
+        }
+    }
+    const __m256i byteMask = _mm256_set1_epi32(0xff);
+    const __m256i opacityMask = _mm256_set1_epi32((int)0xff000000);
+    const __m256 maxRGB = _mm256_set1_ps((float)MaxRGB);
+    const __m256 zero = _mm256_setzero_ps();
+    unsigned long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pixels + i));
+        __m256i b = _mm256_and_si256(v, byteMask);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 8), byteMask);
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(v, 16), byteMask);
+        __m256d rl = _mm256_cvtepi32_pd(_mm256_castsi256_si128(r));
+        __m256d gl = _mm256_cvtepi32_pd(_mm256_castsi256_si128(g));
+        __m256d bl = _mm256_cvtepi32_pd(_mm256_castsi256_si128(b));
+        __m256d rh = _mm256_cvtepi32_pd(_mm256_extracti128_si256(r, 1));
+        __m256d gh = _mm256_cvtepi32_pd(_mm256_extracti128_si256(g, 1));
+        __m256d bh = _mm256_cvtepi32_pd(_mm256_extracti128_si256(b, 1));
+        __m256i out[3];
+        for (unsigned int c = 0; c < 3; c++) {
+            __m256 f = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(dot(m[c], rl, gl, bl))),
+                                            _mm256_cvtpd_ps(dot(m[c], rh, gh, bh)), 1);
+            f = _mm256_max_ps(_mm256_min_ps(f, maxRGB), zero);
+            out[c] = _mm256_cvttps_epi32(f);
+        }
+        __m256i res = _mm256_or_si256(_mm256_and_si256(v, opacityMask), _mm256_slli_epi32(out[0], 16));
+        res = _mm256_or_si256(res, _mm256_slli_epi32(out[1], 8));
+        res = _mm256_or_si256(res, out[2]);
+        _mm256_storeu_si256((__m256i*)(pixels + i), res);
+    }
+    trans::colorMatrixScalar(matrix, pixels + i, n - i);
+}
+
+const trans::ColorMatrixKernel::Func trans::colorMatrixAVX2 = ::colorMatrixAVX2;
+#else
+const trans::ColorMatrixKernel::Func trans::colorMatrixAVX2 = NULL;
+#endif
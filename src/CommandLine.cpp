@@ -0,0 +1,355 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * imagealter, a command line driver for bulk offline processing with
+ * the same engine the service uses.
+ *
+ * usage: imagealter [options] -o OUTDIR INPUT...
+ */
+
+#include "ImageProcessor.hh"
+#include "Actions.hh"
+#include "Json.hh"
+#include "Profile.hh"
+#include "Resample.hh"
+#include "Trace.hh"
+#include "WorkerPool.hh"
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLI_DEFAULT_QUALITY 75
+
+static const char* s_usage =
+    "usage: imagealter [options] -o OUTDIR INPUT...\n"
+    "  INPUT is an image, a directory of images, or @FILE naming a file\n"
+    "  which lists an image per line.\n"
+    "options:\n"
+    "  -a ACTIONS  the actions to perform, as JSON: either a list like the\n"
+    "              service's actions argument, or an object with actions,\n"
+    "              format and quality properties (as in unittest/cases).\n"
+    "              @FILE reads the JSON from FILE.\n"
+    "  -f FORMAT   output format (jpg, png, gif, ...), default the input's\n"
+    "  -q QUALITY  output quality 0-100, default 75\n"
+    "  -j JOBS     images to process at once, default one per core\n"
+    "  -m          transform every frame of animated images, rather than\n"
+    "              keeping only the first\n"
+    "  -n          resize with the native resampler rather than\n"
+    "              GraphicsMagick's (faster, slightly different results)\n"
+    "  -v          log everything the engine says\n";
+
+static bool s_verbose = false;
+static boost::mutex s_outputLock;
+
+// the engine's logging, to stderr.  Only warnings and errors unless -v.
+void
+bplus::service::Service::log(unsigned int level, const std::string& msg) {
+    if (!s_verbose && level > BP_WARN) {
+        return;
+    }
+    boost::mutex::scoped_lock lock(s_outputLock);
+    std::cerr << msg << std::endl;
+}
+
+// what's shared by all images
+struct Run {
+    Run() : type(imageproc::UNKNOWN), quality(CLI_DEFAULT_QUALITY), allFrames(false),
+            done(0), failed(0), bytesIn(0), bytesOut(0) { }
+    boost::filesystem::path outDir;
+    imageproc::Type type;
+    int quality;
+    bool allFrames;
+    // args point into actionArgs
+    boost::scoped_ptr<bplus::Object> actionArgs;
+    trans::ActionList actions;
+    boost::mutex lock;
+    unsigned int done;
+    unsigned int failed;
+    boost::uintmax_t bytesIn;
+    boost::uintmax_t bytesOut;
+};
+
+static bool
+readFile(const std::string& path, std::string& contents) {
+    std::ifstream f(path.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!f) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << f.rdbuf();
+    contents = ss.str();
+    return true;
+}
+
+// the actions, and perhaps format and quality, from -a
+static bool
+parseActionsArg(const std::string& arg, Run& run, bool haveFormat, bool haveQuality) {
+    std::string text = arg;
+    if (!arg.empty() && arg[0] == '@' && !readFile(arg.substr(1), text)) {
+        std::cerr << "couldn't read " << arg.substr(1) << std::endl;
+        return false;
+    }
+    std::string err;
+    bplus::Object* o = imageproc::parseJson(text, err);
+    if (!o) {
+        std::cerr << "actions: " << err << std::endl;
+        return false;
+    }
+    if (o->type() == BPTMap) {
+        // a test case: actions, format and quality, any file is ignored
+        if (!haveFormat && o->has("format", BPTString)) {
+            run.type = imageproc::pathToType(*(o->get("format")));
+            if (run.type == imageproc::UNKNOWN) {
+                std::cerr << "can't determine output format" << std::endl;
+                delete o;
+                return false;
+            }
+        }
+        if (!haveQuality && o->has("quality", BPTInteger)) {
+            run.quality = (int)(long long)*(o->get("quality"));
+        }
+        bplus::Object* actions = o->has("actions", BPTList) ? o->get("actions")->clone() : new bplus::List;
+        delete o;
+        o = actions;
+    }
+    run.actionArgs.reset(o);
+    if (o->type() != BPTList) {
+        std::cerr << "actions must be a list" << std::endl;
+        return false;
+    }
+    if (!trans::parseActions(*((const bplus::List*)o), run.actions, err)) {
+        std::cerr << "actions: " << err << std::endl;
+        return false;
+    }
+    trans::optimizeActions(run.actions);
+    return true;
+}
+
+// add the images INPUT names to paths
+static bool
+addInput(const std::string& input, std::vector<std::string>& paths) {
+    if (!input.empty() && input[0] == '@') {
+        std::ifstream f(input.substr(1).c_str());
+        if (!f) {
+            std::cerr << "couldn't read " << input.substr(1) << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(f, line)) {
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.erase(line.size() - 1);
+            }
+            if (!line.empty()) {
+                paths.push_back(line);
+            }
+        }
+        return true;
+    }
+    boost::system::error_code ec;
+    if (!boost::filesystem::is_directory(input, ec)) {
+        paths.push_back(input);
+        return true;
+    }
+    // the images in a directory, in name order
+    std::vector<std::string> found;
+    boost::filesystem::directory_iterator end;
+    for (boost::filesystem::directory_iterator it(input, ec); !ec && it != end; it.increment(ec)) {
+        if (boost::filesystem::is_regular_file(it->status()) &&
+            imageproc::pathToType(it->path().string()) != imageproc::UNKNOWN) {
+            found.push_back(it->path().string());
+        }
+    }
+    if (ec) {
+        std::cerr << "couldn't list " << input << ": " << ec.message() << std::endl;
+        return false;
+    }
+    std::sort(found.begin(), found.end());
+    paths.insert(paths.end(), found.begin(), found.end());
+    return true;
+}
+
+// transform one image, leaving the result in the output directory
+// named after the input
+static void
+runOne(Run* run, const std::string path) {
+    std::string err;
+    unsigned int x;
+    unsigned int y;
+    unsigned int orig_x;
+    unsigned int orig_y;
+    std::string rez = imageproc::ChangeImage(path, run->outDir.string(), run->type, run->actions,
+                                             run->quality, x, y, orig_x, orig_y, err,
+                                             run->allFrames);
+    boost::system::error_code ec;
+    boost::uintmax_t in = boost::filesystem::file_size(path, ec);
+    if (ec) {
+        in = 0;
+    }
+    std::stringstream ss;
+    boost::uintmax_t out = 0;
+    if (rez.empty()) {
+        ss << path << ": " << (err.empty() ? "unknown error" : err);
+    } else {
+        boost::filesystem::path from(rez);
+        boost::filesystem::path inPath(path);
+        std::string name = inPath.stem().string();
+        if (run->type != imageproc::UNKNOWN) {
+            name.append(".").append(imageproc::typeToExt(run->type));
+        } else {
+            name.append(inPath.extension().string());
+        }
+        boost::filesystem::path to = run->outDir / name;
+        // inputs with the same name keep the unique name they were given
+        if (!boost::filesystem::exists(to)) {
+            boost::filesystem::rename(from, to, ec);
+            if (!ec) {
+                from = to;
+            }
+        }
+        out = boost::filesystem::file_size(from, ec);
+        if (ec) {
+            out = 0;
+        }
+        ss << path << " -> " << from.string() << " (" << orig_x << "x" << orig_y
+           << " -> " << x << "x" << y << ")";
+    }
+    {
+        boost::mutex::scoped_lock lock(s_outputLock);
+        (rez.empty() ? std::cerr : std::cout) << ss.str() << std::endl;
+    }
+    boost::mutex::scoped_lock lock(run->lock);
+    run->done++;
+    if (rez.empty()) {
+        run->failed++;
+    }
+    run->bytesIn += in;
+    run->bytesOut += out;
+}
+
+int
+main(int argc, char** argv) {
+    Run run;
+    std::string actionsArg;
+    std::string format;
+    bool haveQuality = false;
+    unsigned int jobs = boost::thread::hardware_concurrency();
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "-v") {
+            // the engine only logs its details while tracing
+            s_verbose = true;
+            imageproc::trace::enable(true);
+        } else if (arg == "-m") {
+            run.allFrames = true;
+        } else if (arg == "-n") {
+            trans::useNativeResampler(true);
+        } else if (arg == "-h" || arg == "--help") {
+            std::cout << s_usage;
+            return 0;
+        } else if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc && strchr("afqjo", arg[1])) {
+            std::string v(argv[++i]);
+            switch (arg[1]) {
+                case 'a': actionsArg = v; break;
+                case 'f': format = v; break;
+                case 'q': run.quality = atoi(v.c_str()); haveQuality = true; break;
+                case 'j': jobs = atoi(v.c_str()); break;
+                case 'o': run.outDir = v; break;
+            }
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "unknown option " << arg << std::endl << s_usage;
+            return 1;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (run.outDir.empty() || inputs.empty()) {
+        std::cerr << s_usage;
+        return 1;
+    }
+    imageproc::init();
+    int rv = 1;
+    std::vector<std::string> paths;
+    do {
+        if (!format.empty()) {
+            run.type = imageproc::pathToType(format);
+            if (run.type == imageproc::UNKNOWN) {
+                std::cerr << "can't determine output format" << std::endl;
+                break;
+            }
+        }
+        if (!parseActionsArg(actionsArg.empty() ? "[]" : actionsArg, run, !format.empty(), haveQuality)) {
+            break;
+        }
+        bool ok = true;
+        for (unsigned int i = 0; ok && i < inputs.size(); i++) {
+            ok = addInput(inputs[i], paths);
+        }
+        if (!ok) {
+            break;
+        }
+        boost::system::error_code ec;
+        boost::filesystem::create_directories(run.outDir, ec);
+        if (!boost::filesystem::is_directory(run.outDir)) {
+            std::cerr << "couldn't create " << run.outDir.string() << std::endl;
+            break;
+        }
+        double start = imageproc::monotonicMillis();
+        {
+            // finishes every image before it goes away
+            imageproc::WorkerPool pool(jobs < 1 ? 1 : jobs, 0);
+            for (unsigned int i = 0; i < paths.size(); i++) {
+                pool.submit(boost::bind(&runOne, &run, paths[i]));
+            }
+        }
+        double seconds = (imageproc::monotonicMillis() - start) / 1000.0;
+        std::stringstream ss;
+        ss.setf(std::ios::fixed);
+        ss.precision(2);
+        ss << run.done << " images (" << run.failed << " failed) in " << seconds << "s with "
+           << (jobs < 1 ? 1 : jobs) << " jobs: " << (seconds > 0 ? run.done / seconds : 0.0)
+           << " images/s, " << (seconds > 0 ? run.bytesIn / seconds / 1048576.0 : 0.0) << " MB/s in, "
+           << (seconds > 0 ? run.bytesOut / seconds / 1048576.0 : 0.0) << " MB/s out";
+        std::cerr << ss.str() << std::endl;
+        rv = run.failed ? 2 : 0;
+    } while (0);
+    imageproc::shutdown();
+    return rv;
+}
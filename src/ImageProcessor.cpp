@@ -32,16 +32,31 @@
 
 #include "ImageProcessor.hh"
 #include "Transformations.hh"
+#include "Actions.hh"
+#include "JPEGRegion.hh"
+#include "OutputCache.hh"
+#include "SourceCache.hh"
+#include "InputFile.hh"
+#include "MemoryBudget.hh"
+#include "Profile.hh"
+#include "Trace.hh"
+#include "BandScheduler.hh"
 #include "magick/api.h"
 #include "bp-file/bpfile.h"
+#include <algorithm>
 #include <sstream>
 #include <assert.h>
+#include <math.h>
 #include <string.h>
 
 #ifdef WIN32
 #define strcasecmp _stricmp
 #endif
 
+// actions are passed the output quality, the actions shared by all
+// renditions are given the best
+#define IP_RENDITION_PREFIX_QUALITY 100
+
 // a map of supported types.
 // written in init, and only read after that (for threading issues)
 struct CaseInsensitiveCompare {
@@ -53,47 +68,71 @@ struct CaseInsensitiveCompare {
 typedef std::map<std::string, std::string, CaseInsensitiveCompare> ExtMap;
 static ExtMap s_imgFormats;
 const imageproc::Type imageproc::UNKNOWN = NULL;
+// when set, results are remembered here
+static imageproc::OutputCache* s_outputCache = NULL;
+// when set, decoded inputs are remembered here
+static imageproc::SourceCache* s_sourceCache = NULL;
+// when set, transforms reserve their memory here before decoding
+static imageproc::MemoryBudget* s_memoryBudget = NULL;
 
 void
 imageproc::init() {
     unsigned int i;
     InitializeMagick(NULL);
-    // let's output a startup banner with available image type support
     ExceptionInfo exception;
     MagickInfo** arr = GetMagickInfoArray(&exception);
+    for (MagickInfo** a = arr; a && *a; a++) {
+        char* mt = MagickToMime((*a)->name);
+        if (mt) {
+            s_imgFormats[(*a)->name] = std::string(mt);
+            free(mt);
+        }
+    }
+    if (!trace::enabled()) {
+        return;
+    }
+    // let's output a startup banner with available image type support
     std::stringstream ss;
     ss << "GraphicsMagick engine initialized with support for: [ ";
-    bool first = true;
-    while (arr && *arr) {
-        if (!first) {
+    for (MagickInfo** a = arr; a && *a; a++) {
+        if (a != arr) {
             ss << ", ";
         }
-        first = false;
-        ss << (*arr)->name;
-        char* mt = MagickToMime((*arr)->name);
-        if (mt) {
-            s_imgFormats[(*arr)->name] = std::string(mt);
-            ss << " (" << mt << ")";
-            free(mt);
+        ss << (*a)->name;
+        ExtMap::const_iterator it = s_imgFormats.find((*a)->name);
+        if (it != s_imgFormats.end()) {
+            ss << " (" << it->second << ")";
         }
-        arr++;
     }
     ss << " ]";
     bplus::service::Service::log(BP_INFO, ss.str());
     ss.str("");
     ss << "Supported transformations: [ ";
-    first = true;
     for (i = 0; i < trans::num(); i++) {
-        if (!first) {
+        if (i > 0) {
             ss << ", ";
         }
-        first = false;
         ss << trans::get(i)->name;
     }
     ss << " ]";
     bplus::service::Service::log(BP_INFO, ss.str());
 }
 
+void
+imageproc::SetOutputCache(OutputCache* cache) {
+    s_outputCache = cache;
+}
+
+void
+imageproc::SetSourceCache(SourceCache* cache) {
+    s_sourceCache = cache;
+}
+
+void
+imageproc::SetMemoryBudget(MemoryBudget* budget) {
+    s_memoryBudget = budget;
+}
+
 void
 imageproc::shutdown() {
     DestroyMagick();
@@ -129,134 +168,262 @@ imageproc::typeToExt(Type t) {
     return ext;
 }
 
+// transformations produce a single frame, so before we modify an image
+// in place we release any frames after the first
+static Image*
+firstFrame(Image* image) {
+    if (image->next) {
+        Image* rest = image->next;
+        image->next = NULL;
+        rest->previous = NULL;
+        DestroyImageList(rest);
+    }
+    return image;
+}
+
+// the memory the pixels of an image list occupy
+static boost::uintmax_t
+IP_PixelBytes(const Image* image) {
+    boost::uintmax_t bytes = 0;
+    for (const Image* f = image; f; f = f->next) {
+        bytes += (boost::uintmax_t)f->columns * f->rows * sizeof(PixelPacket);
+    }
+    return bytes;
+}
+
+// apply a run of fused pixel-local transformations to image, in place.
+// Like every other action the run keeps only the first frame, even when
+// it leaves the pixels alone (a noop).
+static Image*
+runPointKernel(Image* image, const trans::PointKernel& kernel, std::string& oError) {
+    image = firstFrame(image);
+    if (kernel.empty()) {
+        return image;
+    }
+    IA_LOG(BP_INFO, "applying " << kernel.size() << " pixel operation(s) in a single pass");
+    if (!kernel.apply(image, oError)) {
+        DestroyImage(image);
+        image = NULL;
+    }
+    return image;
+}
+
+// run the actions starting at first (earlier ones having been
+// performed while decoding), timing each in profile if it's given
 static
-Image* runTransformations(Image* image, const bplus::List& transList, int quality, std::string& oError) {
-    std::stringstream ss;
-    ss.str("");
-    ss << transList.size() << " transformation actions specified";
-    bplus::service::Service::log(BP_INFO, ss.str());
-    for (unsigned int i = 0; i < transList.size(); i++) {
-        const bplus::Object* o = transList.value(i);
-        std::string command;
-        const bplus::Object* args = NULL;
-        // o may either be a string transformation: i.e. "solarize"
-        // or a may transform: i.e. { "crop": { .25, .75, .25, .75 } }
-        // first we'll extract the command
-        if (o->type() == BPTString) {
-            command = (std::string)(*o);
-        } else if (o->type() == BPTMap) {
-            const bplus::Map* m = (const bplus::Map*)o;
-            if (m->size() != 1) {
-                std::stringstream ss;
-                ss << "transform " << i << " is malformed.  An action is  "
-                   << "an object with a single property which is the action "
-                   << "name";
-                oError = ss.str();
+Image* runTransformations(Image* image, const trans::ActionList& actions, unsigned int first, int quality, std::string& oError,
+                          imageproc::Profile* profile = NULL) {
+    imageproc::Profile scratch;
+    imageproc::Profile& prof = profile ? *profile : scratch;
+    // consecutive pixel-local transformations are collected here and
+    // applied together when the run ends
+    trans::PointKernel kernel;
+    std::string kernelNames;
+    for (unsigned int i = first; i < actions.size(); i++) {
+        const trans::Transformation* t = actions[i].transformation;
+        const bplus::Object* args = actions[i].args;
+        IA_LOG(BP_INFO, "transform [" << t->name << "] with" << (args ? "" : "out") << " args");
+        if (t->pointOp) {
+            if (!t->pointOp(kernel, args, oError)) {
                 break;
             }
-            bplus::Map::Iterator i(*m);
-            command.append(i.nextKey());
-            args = m->get(command.c_str());
-            assert(args != NULL);
-        } else {
-            std::stringstream ss;
-            ss << "transform " << i << " is malformed.  An action is  "
-               << "either a string or an object with a single property which "
-               << "is the name of an action to perform";
-            oError = ss.str();
-            break;
-        }
-        ss.str("");
-        ss << "transform [" << command << "] with" << (args ? "" : "out") << " args",
-        bplus::service::Service::log(BP_INFO, ss.str());
-        // does the command exist?
-        const trans::Transformation* t = trans::get(command);
-        if (t == NULL) {
-            std::stringstream ss;
-            ss << "no such transformation: " << command;
-            oError = ss.str();
-            break;
-        }
-        // are the arguments correct?
-        if (t->requiresArgs && !args) {
-            oError.append(command);
-            oError.append(" missing required argument");
-            break;
+            kernelNames.append(kernelNames.empty() ? "" : "+").append(t->name);
+            continue;
         }
-        if (!t->acceptsArgs && args) {
-            oError.append(command);
-            oError.append(" doesn't accept arguments");
-            break;
+        if (!kernelNames.empty()) {
+            IA_TRACE_SCOPE("pointKernel");
+            prof.begin(kernelNames);
+            image = runPointKernel(image, kernel, oError);
+            prof.end();
+            prof.pixels(IP_PixelBytes(image));
+            kernel = trans::PointKernel();
+            kernelNames.clear();
         }
-        {
-            Image* newImage = t->transform(image, args, quality, oError);
-            DestroyImage(image);
-            image = newImage;
+        if (image) {
+            IA_TRACE_SCOPE(t->name);
+            boost::uintmax_t before = IP_PixelBytes(image);
+            prof.begin(t->name);
+            if (t->transformInPlace) {
+                // we never need the old image, so let it be reused
+                image = t->transformInPlace(firstFrame(image), args, quality, oError);
+                prof.end();
+                prof.pixels(std::max(before, IP_PixelBytes(image)));
+            } else {
+                Image* newImage = t->transform(image, args, quality, oError);
+                prof.end();
+                prof.pixels(before + IP_PixelBytes(newImage));
+                DestroyImageList(image);
+                image = newImage;
+            }
         }
         // abort if the transformation failed
         if (!image) {
             break;
         }
     }
+    if (oError.empty() && image && !kernelNames.empty()) {
+        IA_TRACE_SCOPE("pointKernel");
+        prof.begin(kernelNames);
+        image = runPointKernel(image, kernel, oError);
+        prof.end();
+        prof.pixels(IP_PixelBytes(image));
+    }
     if (!oError.empty() && image) {
-        DestroyImage(image);
+        DestroyImageList(image);
         image = NULL;
     }
     return image;
 }
 
+// will an image transformed by actions still have all its frames?  Only
+// if there are no actions, as every action keeps just the first frame.
+static bool
+IP_KeepsFrames(const trans::ActionList& actions) {
+    return actions.empty();
+}
+
+// is the first frame all that transforming with actions and writing in
+// outputFormat can use?  It is if the actions drop the rest (unless
+// allFrames has them run on every frame), or if the output format can't
+// hold more than one frame.  Written in the input format, the result
+// may be animated.
+static bool
+IP_FirstFrameSuffices(imageproc::Type outputFormat, const trans::ActionList& actions,
+                      bool allFrames) {
+    if (!allFrames && !IP_KeepsFrames(actions)) {
+        return true;
+    }
+    if (outputFormat == imageproc::UNKNOWN) {
+        return false;
+    }
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    const MagickInfo* mi = GetMagickInfo(outputFormat, &exception);
+    DestroyExceptionInfo(&exception);
+    return mi && !mi->adjoin;
+}
+
+// how each frame of an animation is transformed
+namespace {
+    struct FrameActions {
+        const trans::ActionList* actions;
+        unsigned int first;
+        int quality;
+    };
+}
+
 static Image*
-IP_ReadImageFile(const ImageInfo* image_info, const std::string& path, ExceptionInfo* exception) {
-    std::stringstream ss;
-    if (path.empty()) {
-        return NULL;
+IP_TransformFrame(const void* data, Image* frame, std::string& oError) {
+    const FrameActions* fa = (const FrameActions*)data;
+    return runTransformations(frame, *fa->actions, fa->first, fa->quality, oError);
+}
+
+// When the first action shrinks the image and the client allows a
+// draft quality result, work out the size the decoder may reduce it to
+// so it can skip work.  That's the size a scale produces, or for a
+// thumbnail THUMBNAIL_SAMPLE_FACTOR times it: ThumbnailImage point
+// samples down to that size itself whenever the reduction is large
+// enough for the decoder to help.  Returns false if there's no useful
+// hint.
+static bool
+decodeSizeHint(const trans::ActionList& actions, unsigned int origX, unsigned int origY, unsigned int& x, unsigned int& y) {
+    if (actions.empty() || !actions[0].args) {
+        return false;
     }
-    std::ifstream fstream;
-    if (!bp::file::openReadableStream(fstream, path, std::ios_base::in | std::ios_base::binary)) {
-        ss.str("");
-        ss << "Couldn't open file for reading: " << path;
-        bplus::service::Service::log(BP_ERROR, ss.str());
-        return NULL;
+    const trans::Transformation* t = actions[0].transformation;
+    bool thumbnail = !strcmp(t->name, "thumbnail");
+    if (strcmp(t->name, "scale") && !thumbnail) {
+        return false;
     }
-    // get filesize
-    fstream.seekg(0, std::ios::end);
-    size_t len = (size_t)fstream.tellg();
-    fstream.seekg(0, std::ios::beg);
-    ss.str("");
-    ss << "file size = " << len;
-    bplus::service::Service::log(BP_DEBUG, ss.str());
-    if (len <= 0) {
-        ss.str("");
-        ss << "Couldn't determine file length: " << path;
-        bplus::service::Service::log(BP_ERROR, ss.str());
-        return NULL;
+    std::string err;
+    bool draft = false;
+    if (!trans::scalingDimensions(t->name, origX, origY, actions[0].args, x, y, draft, err) || !draft) {
+        return false;
     }
-    void* img = malloc(len);
-    if (img == NULL) {
-        ss.str("");
-        ss << "memory allocation failed (" << len << " bytes) when trying to read image";
-        bplus::service::Service::log(BP_ERROR, ss.str());
-        return NULL;
+    if (thumbnail) {
+        x *= THUMBNAIL_SAMPLE_FACTOR;
+        y *= THUMBNAIL_SAMPLE_FACTOR;
     }
-    ss.str("");
-    ss << "Attempting to read " << len << " bytes from '" << path << "'";
-    bplus::service::Service::log(BP_INFO, ss.str());
-    fstream.read((char*)img, len);
-    size_t rd = (size_t)fstream.gcount();
-    fstream.close();
-    if (rd != len) {
-        ss.str("");
-        ss << "Partial read detected, got " << rd << " of " << len << " bytes";
-        bplus::service::Service::log(BP_ERROR, ss.str());
-        free(img);
-        return NULL;
+    return x > 0 && y > 0 && (x < origX || y < origY);
+}
+
+// can the decoder skip work for the first action?  Only a crop or a
+// downscale lets it, and only then is it worth reading the headers
+// first to find out.
+static bool
+decoderMayHelp(const trans::ActionList& actions) {
+    if (actions.empty() || !actions[0].args) {
+        return false;
+    }
+    const char* name = actions[0].transformation->name;
+    return !strcmp(name, "crop") || !strcmp(name, "scale") || !strcmp(name, "thumbnail");
+}
+
+// if the first action is a crop, work out the region it selects from an
+// image of origX by origY pixels
+static bool
+leadingCropRegion(const trans::ActionList& actions, unsigned int origX, unsigned int origY, RectangleInfo& ri) {
+    if (actions.empty() || !actions[0].args || strcmp(actions[0].transformation->name, "crop")) {
+        return false;
+    }
+    std::string err;
+    return trans::cropRegion(origX, origY, actions[0].args, ri, err);
+}
+
+// decode an in memory image, letting the decoder skip work when the
+// first action allows it: a leading crop is decoded as just that region
+// of the image, and a leading draft downscale is decoded at reduced
+// size.  actionsDone is set to the number of leading actions that were
+// performed while decoding.
+static Image*
+IP_DecodeImage(ImageInfo* image_info, const void* blob, size_t len, const trans::ActionList& actions, unsigned int& actionsDone, ExceptionInfo* exception) {
+    std::stringstream ss;
+    unsigned int origX = 0;
+    unsigned int origY = 0;
+    actionsDone = 0;
+    if (decoderMayHelp(actions)) {
+        // a header only read tells us what we're dealing with
+        ExceptionInfo pingException;
+        GetExceptionInfo(&pingException);
+        Image* ping = PingBlob(image_info, blob, len, &pingException);
+        if (ping) {
+            unsigned int x = 0;
+            unsigned int y = 0;
+            RectangleInfo ri;
+            if (!strcmp(ping->magick, "JPEG") && ping->next == NULL &&
+                leadingCropRegion(actions, ping->columns, ping->rows, ri)) {
+                Image* region = imageproc::ReadJPEGRegion(image_info, ping, blob, len, ri, exception);
+                if (region) {
+                    IA_LOG(BP_INFO, "decoded " << ri.width << "x" << ri.height << " region of "
+                                << ping->columns << "x" << ping->rows << " image");
+                    DestroyImageList(ping);
+                    DestroyExceptionInfo(&pingException);
+                    actionsDone = 1;
+                    return region;
+                }
+            }
+            // only JPEG interprets the size as a hint, for raw formats
+            // it would define the image geometry
+            if (!strcmp(ping->magick, "JPEG") &&
+                decodeSizeHint(actions, ping->columns, ping->rows, x, y)) {
+                origX = ping->columns;
+                origY = ping->rows;
+                ss << x << "x" << y;
+                (void)CloneString(&image_info->size, ss.str().c_str());
+                IA_LOG(BP_INFO, "decoding " << origX << "x" << origY << " image at no less than " << image_info->size);
+            }
+            DestroyImageList(ping);
+        }
+        DestroyExceptionInfo(&pingException);
+    }
+    Image* i = BlobToImage(image_info, blob, len, exception);
+    if (i && origX) {
+        // the client's view of the original size is the full size
+        for (Image* f = i; f; f = f->next) {
+            f->magick_columns = origX;
+            f->magick_rows = origY;
+        }
     }
-    // now convert it into a GM image
-    Image* i = BlobToImage(image_info, img, len, exception);
-    ss.str("");
-    ss << "read img: " << i;
-    bplus::service::Service::log(BP_ERROR, ss.str());
-    free(img);
     return i;
 }
 
@@ -270,74 +437,483 @@ imageproc::ChangeImage(const std::string& inPath,
                        unsigned int& y,
                        unsigned int& orig_x,
                        unsigned int& orig_y,
-                       std::string& oError) {
-    std::stringstream ss;
-    ExceptionInfo exception;
-    Image* images;
-    ImageInfo* image_info;
+                       std::string& oError,
+                       bool allFrames,
+                       Profile* profile) {
     orig_x = 0;
     orig_y = 0;
     x = 0;
     y = 0;
+    // validate the actions before doing any real work, and find a
+    // cheaper equivalent to run
+    trans::ActionList actions;
+    if (!trans::parseActions(transformations, actions, oError)) {
+        return std::string();
+    }
+    trans::optimizeActions(actions);
+    IA_LOG(BP_INFO, transformations.size() << " transformation actions specified, "
+                << actions.size() << " after optimization");
+    return ChangeImage(inPath, tmpDir, outputFormat, actions, quality,
+                       x, y, orig_x, orig_y, oError, allFrames, profile);
+}
+
+// decode the image read from inPath into blob, performing any leading
+// actions the decoder can.  With firstFrame the decoder stops after the
+// first frame.  Failures are logged, and reported in oError.
+static Image*
+IP_Read(ImageInfo* image_info, const std::string& inPath, const void* blob, size_t len,
+        const trans::ActionList& actions, bool firstFrame, unsigned int& actionsDone,
+        std::string& oError) {
+    IA_TRACE_SCOPE("decode");
+    std::stringstream ss;
+    ExceptionInfo exception;
     GetExceptionInfo(&exception);
-    image_info = CloneImageInfo((ImageInfo*)NULL);
-    // first we read the image
+    (void)strcpy(image_info->filename, inPath.c_str());
+    actionsDone = 0;
+    if (firstFrame) {
+        IA_LOG(BP_INFO, "decoding only the first frame");
+        image_info->subimage = 0;
+        image_info->subrange = 1;
+    }
+    Image* images = IP_DecodeImage(image_info, blob, len, actions, actionsDone, &exception);
+    image_info->subimage = 0;
+    image_info->subrange = 0;
     if (exception.severity != UndefinedException) {
+        // decoders warn about plenty of images that read fine
+        unsigned int level = exception.severity < ErrorException ? BP_WARN : BP_ERROR;
         if (exception.reason) {
             ss.str("");
             ss << "after: " << exception.reason << std::endl;
-            bplus::service::Service::log(BP_ERROR, ss.str());
+            bplus::service::Service::log(level, ss.str());
         }
         if (exception.description) {
             ss.str("");
             ss << "after: " << exception.description << std::endl;
-            bplus::service::Service::log(BP_ERROR, ss.str());
+            bplus::service::Service::log(level, ss.str());
         }
         CatchException(&exception);
     }
+    DestroyExceptionInfo(&exception);
+    if (!images) {
+        oError.append("couldn't read image");
+        return NULL;
+    }
+    IA_LOG(BP_INFO, "Image contains " << GetImageListLength(images) << " frames, type: " << images->magick << std::endl);
+    return images;
+}
+
+// read just the headers of the image in blob for its size and number
+// of frames
+static bool
+IP_Ping(const std::string& inPath, const void* blob, size_t len,
+        unsigned long& columns, unsigned long& rows, unsigned long& frames) {
+    ImageInfo* image_info = CloneImageInfo((ImageInfo*)NULL);
     (void)strcpy(image_info->filename, inPath.c_str());
-    images = IP_ReadImageFile(image_info, inPath, &exception);
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    Image* ping = PingBlob(image_info, blob, len, &exception);
+    DestroyExceptionInfo(&exception);
+    DestroyImageInfo(image_info);
+    if (!ping) {
+        return false;
+    }
+    columns = ping->columns;
+    rows = ping->rows;
+    frames = GetImageListLength(ping);
+    DestroyImageList(ping);
+    return true;
+}
+
+// estimate the memory that transforming frames frames of columns by
+// rows pixels with actions needs at its peak: the decoded frames, plus
+// the input and output of the largest step.  Decoding only a region or
+// a reduced size can make it an overestimate.
+static boost::uintmax_t
+IP_PeakBytes(unsigned long columns, unsigned long rows, unsigned long frames,
+             const trans::ActionList& actions) {
+    boost::uintmax_t frame = (boost::uintmax_t)columns * rows * sizeof(PixelPacket);
+    boost::uintmax_t largest = frame;
+    unsigned int x = columns;
+    unsigned int y = rows;
+    for (unsigned int i = 0; i < actions.size(); i++) {
+        const char* name = actions[i].transformation->name;
+        const bplus::Object* args = actions[i].args;
+        unsigned int nx = x;
+        unsigned int ny = y;
+        std::string err;
+        if (args && (!strcmp(name, "scale") || !strcmp(name, "thumbnail"))) {
+            bool draft;
+            if (!trans::scalingDimensions(name, x, y, args, nx, ny, draft, err)) {
+                nx = x;
+                ny = y;
+            }
+        } else if (args && !strcmp(name, "crop")) {
+            RectangleInfo ri;
+            if (trans::cropRegion(x, y, args, ri, err)) {
+                nx = ri.width;
+                ny = ri.height;
+            }
+        } else if (args && !strcmp(name, "rotate")) {
+            double degrees;
+            if (trans::rotationDegrees(args, degrees, err)) {
+                double r = fmod(fabs(degrees), 180.0);
+                if (r == 90.0) {
+                    nx = y;
+                    ny = x;
+                } else if (r != 0.0) {
+                    // big enough for any angle
+                    nx = ny = x + y;
+                }
+            }
+        }
+        x = nx;
+        y = ny;
+        largest = std::max(largest, (boost::uintmax_t)x * y * sizeof(PixelPacket));
+    }
+    return frame * frames + (actions.empty() ? 0 : 2 * largest);
+}
+
+static int
+IP_ClampQuality(int quality) {
+    if (quality > 100) {
+        quality = 100;
+    }
+    if (quality < 0) {
+        quality = 0;
+    }
+    return quality;
+}
+
+// the name of the file we write a transformed inPath to
+static std::string
+IP_OutputName(const std::string& inPath, imageproc::Type outputFormat) {
+    std::string name;
+    if (outputFormat == imageproc::UNKNOWN) {
+        boost::filesystem::path inPath1(inPath);
+        name.append(inPath1.stem().string());
+    }
+    else {
+        name.append("img.");
+        name.append(imageproc::typeToExt(outputFormat));
+    }
+    return name;
+}
+
+// can images be encoded straight into a file?  this needs a coder that
+// writes through GM's blob layer, and which writes every frame to one file
+static bool
+IP_CanStream(const Image* images) {
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    const MagickInfo* mi = GetMagickInfo(images->magick, &exception);
+    DestroyExceptionInfo(&exception);
+    return mi && mi->blob_support && (images->next == NULL || mi->adjoin);
+}
+
+// encode images directly into the file at path, populating oError on
+// failure.  We open the file
+// ourselves rather than handing GM a filename so that we can handle
+// wide filenames safely on win32 systems.
+static bool
+IP_StreamImage(ImageInfo* image_info, Image* images, const boost::filesystem::path& path,
+               std::string& oError) {
+    std::stringstream ss;
+#ifdef WIN32
+    FILE* f = _wfopen(path.c_str(), L"wb");
+#else
+    FILE* f = fopen(path.string().c_str(), "wb");
+#endif
+    if (f == NULL) {
+        ss << "Couldn't open '" << path.string() << "' for writing!";
+        bplus::service::Service::log(BP_ERROR, ss.str());
+        oError.append("Error saving output image");
+        return false;
+    }
+    IA_LOG(BP_INFO, "Streaming image to " << path.string());
+    // as ImageToBlob does, clear the filenames so that the format comes
+    // from images->magick rather than an extension
+    for (Image* i = images; i; i = i->next) {
+        i->filename[0] = '\0';
+    }
+    image_info->file = f;
+    unsigned int status = WriteImage(image_info, images);
+    image_info->file = NULL;
+    bool ok = status != 0 && images->exception.severity < ErrorException;
+    if (!ok) {
+        ss.str("");
+        ss << "WriteImage failed";
+        if (images->exception.reason) {
+            ss << ": " << images->exception.reason;
+        }
+        bplus::service::Service::log(BP_ERROR, ss.str());
+    }
+    if (ferror(f)) {
+        ok = false;
+    }
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        oError.append("Error saving output image");
+    }
+    return ok;
+}
+
+// encode images into memory, then write them to path, populating
+// oError on failure
+static bool
+IP_WriteBlob(ImageInfo* image_info, Image* images, const boost::filesystem::path& path,
+             std::string& oError) {
+    std::stringstream ss;
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    size_t l = 0;
+    void* blob = ImageToBlob(image_info, images, &l, &exception);
     if (exception.severity != UndefinedException) {
-        if (exception.reason) {
+        oError.append("ImageToBlob failed.");
+        CatchException(&exception);
+        DestroyExceptionInfo(&exception);
+        if (blob) {
+            MagickFree(blob);
+        }
+        return false;
+    }
+    DestroyExceptionInfo(&exception);
+    IA_LOG(BP_INFO, "Writing " << l << " bytes to " << path.string());
+    std::ofstream ofs;
+    bool ok = false;
+    if (!bp::file::openWritableStream(ofs, path, std::ios_base::out | std::ios_base::binary)) {
+        ss.str("");
+        ss << "Couldn't open '" << path.string() << "' for writing!";
+        bplus::service::Service::log(BP_ERROR, ss.str());
+    } else {
+        ofs.write((const char*)blob, l);
+        ok = !ofs.bad();
+        ofs.close();
+        if (!ok) {
             ss.str("");
-            ss << "after: " << exception.reason << std::endl;
+            ss << "Bad write (\?\?/" << l << ") when writing resultant image '" << path.string() << "'";
             bplus::service::Service::log(BP_ERROR, ss.str());
         }
-        if (exception.description) {
+    }
+    if (!ok) {
+        oError.append("Error saving output image");
+    }
+    MagickFree(blob);
+    return ok;
+}
+
+// encode images in outputFormat (or the input format) and write the
+// result to a new file in tmpDir.  returns the path of the file, or
+// .empty() and populates oError on failure.
+static std::string
+IP_Write(ImageInfo* image_info, Image* images, const std::string& inPath,
+         const std::string& tmpDir, imageproc::Type outputFormat, std::string& oError) {
+    IA_TRACE_SCOPE("write");
+    std::stringstream ss;
+    // let's set the output format correctly (default to input format)
+    std::string name = IP_OutputName(inPath, outputFormat);
+    if (outputFormat != imageproc::UNKNOWN) {
+        (void)sprintf(images->magick, outputFormat);
+        IA_LOG(BP_INFO, "Output to format: " << outputFormat);
+    }
+    if (!boost::filesystem::is_directory(tmpDir) && !boost::filesystem::create_directory(tmpDir)) {
+        oError.append("Couldn't create temp dir");
+        return std::string();
+    }
+    // the image is written under a temporary name and renamed once
+    // complete, so nobody sees a partial file under the name we return
+    boost::filesystem::path outpath = bp::file::getTempPath(tmpDir, name);
+    boost::filesystem::path partpath = outpath.string() + ".part";
+    bool ok;
+    if (IP_CanStream(images)) {
+        ok = IP_StreamImage(image_info, images, partpath, oError);
+    } else {
+        ok = IP_WriteBlob(image_info, images, partpath, oError);
+    }
+    if (ok) {
+        boost::system::error_code ec;
+        boost::filesystem::rename(partpath, outpath, ec);
+        if (ec) {
             ss.str("");
-            ss << "after: " << exception.description << std::endl;
+            ss << "Couldn't rename '" << partpath.string() << "': " << ec.message();
             bplus::service::Service::log(BP_ERROR, ss.str());
+            oError.append("Error saving output image");
+            ok = false;
+        }
+    }
+    if (!ok) {
+        (void)bp::file::remove(partpath);
+        return std::string();
+    }
+    return outpath.string();
+}
+
+std::string
+imageproc::ChangeImage(const std::string& inPath,
+                       const std::string& tmpDir,
+                       Type outputFormat,
+                       const trans::ActionList& actions,
+                       int quality,
+                       unsigned int& x,
+                       unsigned int& y,
+                       unsigned int& orig_x,
+                       unsigned int& orig_y,
+                       std::string& oError,
+                       bool allFrames,
+                       Profile* profile) {
+    IA_TRACE_SCOPE("transform");
+    Profile scratch;
+    Profile& prof = profile ? *profile : scratch;
+    orig_x = 0;
+    orig_y = 0;
+    x = 0;
+    y = 0;
+    quality = IP_ClampQuality(quality);
+    // have we decoded this version of the file before?
+    Image* images = NULL;
+    SourceCache::Stamp stamp;
+    bool cacheSource = s_sourceCache && SourceCache::stamp(inPath, stamp);
+    if (cacheSource) {
+        prof.begin("sourceCache");
+        images = s_sourceCache->lookup(inPath, stamp, !allFrames && !IP_KeepsFrames(actions));
+        prof.end();
+        prof.bytesIn = stamp.size;
+    }
+    // if not (or if the result cache wants its bytes) we read the file
+    InputFile input;
+    if (!images || s_outputCache) {
+        prof.begin("read");
+        bool opened = input.open(inPath);
+        prof.end();
+        prof.bytesIn = input.size();
+        if (!opened) {
+            if (images) {
+                DestroyImageList(images);
+            }
+            oError.append("couldn't read image");
+            return std::string();
+        }
+    }
+    // have we done exactly this before?
+    std::string cacheKey;
+    if (s_outputCache) {
+        prof.begin("resultCache");
+        cacheKey = OutputCache::key(input.data(), input.size(), actions, outputFormat, quality,
+                                    allFrames);
+        if (boost::filesystem::is_directory(tmpDir) || boost::filesystem::create_directory(tmpDir)) {
+            boost::filesystem::path outpath = bp::file::getTempPath(tmpDir, IP_OutputName(inPath, outputFormat));
+            OutputCache::Result r;
+            if (s_outputCache->lookup(cacheKey, outpath, r)) {
+                prof.end();
+                boost::system::error_code ec;
+                prof.bytesOut = boost::filesystem::file_size(outpath, ec);
+                if (images) {
+                    DestroyImageList(images);
+                }
+                IA_LOG(BP_INFO, "returning cached result");
+                x = r.x;
+                y = r.y;
+                orig_x = r.orig_x;
+                orig_y = r.orig_y;
+                return outpath.string();
+            }
+        }
+        prof.end();
+    }
+    // frames the output can't use needn't be decoded.  The source cache
+    // holds every frame, so it's read in full when that's in use.
+    bool firstFrame = !cacheSource && IP_FirstFrameSuffices(outputFormat, actions, allFrames);
+    // wait until there's memory to do it in
+    MemoryBudget::Reservation reservation;
+    if (s_memoryBudget) {
+        prof.begin("admission");
+        boost::uintmax_t peak = 0;
+        unsigned long columns;
+        unsigned long rows;
+        unsigned long frames;
+        // frames transformed in parallel are each coalesced into a copy,
+        // and may all be part way through a step at once
+        bool parallel = allFrames && !IP_KeepsFrames(actions);
+        bool sized;
+        if (images) {
+            // a copy of the cached decode shares its pixels only until
+            // they're first written to, so it's counted like a fresh one
+            columns = images->columns;
+            rows = images->rows;
+            frames = GetImageListLength(images);
+            sized = true;
+        } else {
+            sized = IP_Ping(inPath, input.data(), input.size(), columns, rows, frames);
+            if (firstFrame) {
+                frames = 1;
+            }
+        }
+        if (sized) {
+            if (parallel && frames > 1) {
+                peak = frames * IP_PeakBytes(columns, rows, 2, actions);
+            } else {
+                peak = IP_PeakBytes(columns, rows, frames, actions);
+            }
+        }
+        bool admitted = reservation.acquire(s_memoryBudget, peak, oError);
+        prof.end();
+        if (!admitted) {
+            if (images) {
+                DestroyImageList(images);
+            }
+            return std::string();
         }
-        CatchException(&exception);
     }
+    // then decode it
+    ImageInfo* image_info = CloneImageInfo((ImageInfo*)NULL);
+    unsigned int actionsDone = 0;
+    if (images) {
+        (void)strcpy(image_info->filename, inPath.c_str());
+        IA_LOG(BP_INFO, "using cached decode of input");
+    } else if (cacheSource) {
+        // what we cache must be the whole image, so the decoder may not
+        // take shortcuts for the actions
+        prof.begin("decode");
+        images = IP_Read(image_info, inPath, input.data(), input.size(), trans::ActionList(),
+                         false, actionsDone, oError);
+        prof.end();
+        if (images) {
+            s_sourceCache->insert(inPath, stamp, images);
+        }
+    } else {
+        prof.begin("decode");
+        images = IP_Read(image_info, inPath, input.data(), input.size(), actions, firstFrame,
+                         actionsDone, oError);
+        prof.end();
+    }
+    prof.pixels(IP_PixelBytes(images));
+    // GraphicsMagick keeps no reference to the input once it's decoded
+    input.close();
     if (!images) {
-        oError.append("couldn't read image");
         DestroyImageInfo(image_info);
-        image_info = NULL;
-        DestroyExceptionInfo(&exception);
         return std::string();
     }
-    ss.str("");
-    ss << "Image contains " << GetImageListLength(images) << " frames, type: " << images->magick << std::endl;
-    bplus::service::Service::log(BP_INFO, ss.str());
     // set quality
-    if (quality > 100) {
-        quality = 100;
-    }
-    if (quality < 0) {
-        quality = 0;
-    }
     image_info->quality = quality;
-    ss.str("");
-    ss << "Quality set to " << quality << " (0-100, worst-best)";
-    bplus::service::Service::log(BP_INFO, ss.str());
-    // execute 'actions'
-    images = runTransformations(images, transformations, quality, oError);
+    IA_LOG(BP_INFO, "Quality set to " << quality << " (0-100, worst-best)");
+    // execute 'actions', on each frame of an animation if asked
+    if (allFrames && images->next && !IP_KeepsFrames(actions)) {
+        IA_LOG(BP_INFO, "transforming " << GetImageListLength(images) << " frames in parallel");
+        FrameActions fa;
+        fa.actions = &actions;
+        fa.first = actionsDone;
+        fa.quality = quality;
+        prof.begin("frames");
+        images = TransformFrames(images, IP_TransformFrame, &fa, oError);
+        prof.end();
+        prof.pixels(IP_PixelBytes(images));
+    } else {
+        images = runTransformations(images, actions, actionsDone, quality, oError, &prof);
+    }
     // was all that successful?
     if (images == NULL) {
         DestroyImageInfo(image_info);
-        image_info = NULL;
-        DestroyExceptionInfo(&exception);
         return std::string();
     }
     // set the output size
@@ -345,72 +921,284 @@ imageproc::ChangeImage(const std::string& inPath,
     orig_y = images->magick_rows;
     x = images->columns;
     y = images->rows;
-    // let's set the output format correctly (default to input format)
-    std::string name;
-    boost::filesystem::path inPath1(inPath);
-    if (outputFormat == UNKNOWN) {
-        name.append(inPath1.stem().string());
+    // encoding and writing happen together as the output is streamed
+    prof.begin("write");
+    std::string rv = IP_Write(image_info, images, inPath, tmpDir, outputFormat, oError);
+    prof.end();
+    if (!rv.empty()) {
+        boost::system::error_code ec;
+        prof.bytesOut = boost::filesystem::file_size(rv, ec);
     }
-    else {
-        name.append("img.");
-        name.append(typeToExt(outputFormat));
-        (void)sprintf(images->magick, outputFormat);
-        ss.str("");
-        ss << "Output to format: " << outputFormat;
-        bplus::service::Service::log(BP_INFO, ss.str());
-    }
-    // Now let's go directly from blob to file.  We bypass
-    // GM to-file functions so that we can handle wide filenames
-    // safely on win32 systems.  A superior solution would
-    // be to use GM stream facilities (if they exist)
-    // upon success, will hold path to output file and will be returned to
-    // client
-    std::string rv;
+    DestroyImageList(images);
+    DestroyImageInfo(image_info);
+    if (s_outputCache && !rv.empty()) {
+        OutputCache::Result r;
+        r.x = x;
+        r.y = y;
+        r.orig_x = orig_x;
+        r.orig_y = orig_y;
+        s_outputCache->insert(cacheKey, rv, r);
+    }
+    return rv;
+}
+
+bool
+imageproc::GetInfo(const std::string& inPath, Info& info, std::string& oError) {
+    IA_TRACE_SCOPE("info");
+    // mapping the file means only the pages holding headers are read
+    InputFile input;
+    if (!input.open(inPath)) {
+        oError.append("couldn't read image");
+        return false;
+    }
+    ImageInfo* image_info = CloneImageInfo((ImageInfo*)NULL);
+    (void)strcpy(image_info->filename, inPath.c_str());
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    Image* ping = PingBlob(image_info, input.data(), input.size(), &exception);
+    if (exception.severity != UndefinedException) {
+        CatchException(&exception);
+    }
+    DestroyExceptionInfo(&exception);
+    DestroyImageInfo(image_info);
+    if (!ping) {
+        oError.append("couldn't read image");
+        return false;
+    }
+    info.format = ping->magick;
+    info.width = ping->columns;
+    info.height = ping->rows;
+    info.frames = GetImageListLength(ping);
+    if (ping->colorspace == CMYKColorspace) {
+        info.colorType = "cmyk";
+    } else if (ping->is_grayscale || ping->colorspace == GRAYColorspace) {
+        info.colorType = "gray";
+    } else if (ping->storage_class == PseudoClass) {
+        info.colorType = "palette";
+    } else {
+        info.colorType = "rgb";
+    }
+    if (ping->matte) {
+        info.colorType.append("a");
+    }
+    info.depth = ping->depth;
+    info.orientation = 0;
+    const ImageAttribute* attr = GetImageAttribute(ping, "EXIF:Orientation");
+    if (attr && attr->value) {
+        int o = atoi(attr->value);
+        if (o >= 1 && o <= 8) {
+            info.orientation = o;
+        }
+    }
+    DestroyImageList(ping);
+    return true;
+}
+
+// if actions begins by shrinking the image, work out the size it
+// shrinks an image of the given size to
+static bool
+leadingDownscale(const trans::ActionList& actions, unsigned long columns, unsigned long rows,
+                 unsigned int& x, unsigned int& y) {
+    if (actions.empty() || !actions[0].args) {
+        return false;
+    }
+    const trans::Transformation* t = actions[0].transformation;
+    if (strcmp(t->name, "scale") && strcmp(t->name, "thumbnail")) {
+        return false;
+    }
+    std::string err;
+    bool draft = false;
+    if (!trans::scalingDimensions(t->name, columns, rows, actions[0].args, x, y, draft, err)) {
+        return false;
+    }
+    return x > 0 && y > 0 && x <= columns && y <= rows;
+}
+
+// a copy of image to run actions over.  Every action keeps only the
+// first frame, so there's no point copying the rest unless there are
+// no actions.
+static Image*
+copyForActions(const Image* image, const trans::ActionList& actions, unsigned int first) {
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    Image* copy;
+    if (first < actions.size()) {
+        copy = CloneImage(image, 0, 0, 1, &exception);
+    } else {
+        copy = CloneImageList(image, &exception);
+    }
+    DestroyExceptionInfo(&exception);
+    return copy;
+}
+
+// order renditions by the area of their leading downscale, largest
+// first, those without one coming last
+namespace {
+    struct CascadeOrder {
+        CascadeOrder(const std::vector<unsigned long>& areas) : m_areas(areas) { }
+        bool operator()(unsigned int a, unsigned int b) const {
+            return m_areas[a] > m_areas[b];
+        }
+        const std::vector<unsigned long>& m_areas;
+    };
+}
+
+bool
+imageproc::MakeRenditions(const std::string& inPath,
+                          const std::string& tmpDir,
+                          const trans::ActionList& prefix,
+                          std::vector<Rendition>& renditions,
+                          std::string& oError) {
+    IA_TRACE_SCOPE("renditions");
+    Image* base = NULL;
+    ImageInfo* image_info = CloneImageInfo((ImageInfo*)NULL);
+    unsigned int actionsDone = 0;
+    MemoryBudget::Reservation reservation;
     {
-        size_t l = 0;
-        void* blob = NULL;
-        blob = ImageToBlob(image_info, images, &l, &exception);
-        if (exception.severity != UndefinedException) {
-            oError.append("ImageToBlob failed.");
-            CatchException(&exception);
-        }
-        else {
-            ss.str("");
-            ss << "Creating tempdir " << tmpDir;
-            bplus::service::Service::log(BP_INFO, ss.str());
-            ss.str("");
-            ss << "Writing " << l << " bytes to " << name;
-            bplus::service::Service::log(BP_INFO, ss.str());
-            if (!boost::filesystem::is_directory(tmpDir) && !boost::filesystem::create_directory(tmpDir)) {
-                oError.append("Couldn't create temp dir");
+        InputFile input;
+        if (!input.open(inPath)) {
+            DestroyImageInfo(image_info);
+            oError.append("couldn't read image");
+            return false;
+        }
+        // room for the base image, the largest rendition and the image
+        // the next rendition shrinks from
+        // the base image needs more than its first frame only if some
+        // rendition can use the others
+        bool firstFrame = true;
+        if (IP_KeepsFrames(prefix)) {
+            for (unsigned int i = 0; firstFrame && i < renditions.size(); i++) {
+                firstFrame = IP_FirstFrameSuffices(renditions[i].outputFormat, renditions[i].actions,
+                                                   false);
+            }
+        }
+        unsigned long columns;
+        unsigned long rows;
+        unsigned long frames;
+        if (s_memoryBudget && IP_Ping(inPath, input.data(), input.size(), columns, rows, frames)) {
+            boost::uintmax_t largest = 0;
+            for (unsigned int i = 0; i < renditions.size(); i++) {
+                largest = std::max(largest, IP_PeakBytes(columns, rows, 0, renditions[i].actions));
+            }
+            boost::uintmax_t peak = IP_PeakBytes(columns, rows, firstFrame ? 1 : frames, prefix) + largest +
+                (boost::uintmax_t)columns * rows * sizeof(PixelPacket);
+            if (!reservation.acquire(s_memoryBudget, peak, oError)) {
+                DestroyImageInfo(image_info);
+                return false;
+            }
+        }
+        base = IP_Read(image_info, inPath, input.data(), input.size(), prefix, firstFrame,
+                       actionsDone, oError);
+    }
+    if (base) {
+        base = runTransformations(base, prefix, actionsDone, IP_RENDITION_PREFIX_QUALITY, oError);
+    }
+    if (!base) {
+        DestroyImageInfo(image_info);
+        return false;
+    }
+    // renditions which start by shrinking are made largest first, each
+    // from the shrunken image of the one before rather than from base
+    std::vector<unsigned long> areas(renditions.size(), 0);
+    std::vector<unsigned int> order(renditions.size());
+    for (unsigned int i = 0; i < renditions.size(); i++) {
+        unsigned int x;
+        unsigned int y;
+        if (leadingDownscale(renditions[i].actions, base->columns, base->rows, x, y)) {
+            areas[i] = (unsigned long)x * y;
+        }
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), CascadeOrder(areas));
+    unsigned long baseColumns = base->columns;
+    unsigned long baseRows = base->rows;
+    Image* cascade = NULL;
+    for (unsigned int n = 0; n < order.size(); n++) {
+        IA_TRACE_SCOPE("rendition");
+        Rendition& r = renditions[order[n]];
+        // an image nothing after this rendition reads is handed over
+        // rather than copied: base after the last rendition, and the
+        // shrunken image unless the next rendition shrinks from it
+        bool lastUse = n + 1 == order.size();
+        bool cascadeNeeded = !lastUse && areas[order[n + 1]] > 0;
+        r.x = r.y = r.orig_x = r.orig_y = 0;
+        r.path.clear();
+        r.error.clear();
+        int quality = IP_ClampQuality(r.quality);
+        unsigned int first = 0;
+        const Image* source = base;
+        unsigned int x;
+        unsigned int y;
+        if (areas[order[n]] > 0) {
+            // shrink from the last, larger, rendition if it's big enough
+            if (cascade && leadingDownscale(r.actions, baseColumns, baseRows, x, y) &&
+                cascade->columns >= x && cascade->rows >= y) {
+                source = cascade;
+            }
+            // the image shrunk from is replaced by the result, so only
+            // base may need copying
+            Image* scaled;
+            if (source == cascade) {
+                scaled = cascade;
+                cascade = NULL;
+            } else if (lastUse) {
+                scaled = base;
+                base = NULL;
             } else {
-                std::ofstream ofs;
-                boost::filesystem::path outpath = bp::file::getTempPath(tmpDir, name);
-                if (!bp::file::openWritableStream(ofs, outpath, std::ios_base::out | std::ios_base::binary)) {
-                    ss.str("");
-                    ss << "Couldn't open '" << outpath.string() << "' for writing!";
-                    bplus::service::Service::log(BP_ERROR, ss.str());
-                    oError.append("Error saving output image");
-                    throw std::string("unable to create new file");
-                }
-                ofs.write((const char*)blob, l);
-                bool bad = ofs.bad();
-                ofs.close();
-                if (bad) {
-                    ss.str("");
-                    ss << "Bad write (\?\?/" << l << ") when writing resultant image '" << outpath.string() << "'";
-                    bplus::service::Service::log(BP_ERROR, ss.str());
-                    oError.append("Error saving output image");
-                } else {
-                    // success!
-                    rv = outpath.string();
+                scaled = copyForActions(source, r.actions, 0);
+            }
+            if (scaled) {
+                trans::ActionList scale(r.actions.begin(), r.actions.begin() + 1);
+                scaled = runTransformations(scaled, scale, 0, quality, r.error);
+            }
+            if (!scaled) {
+                if (r.error.empty()) {
+                    r.error.append("couldn't scale image");
                 }
+                continue;
+            }
+            if (cascade) {
+                DestroyImageList(cascade);
             }
+            cascade = scaled;
+            source = cascade;
+            first = 1;
         }
+        IA_LOG(BP_INFO, "making rendition '" << r.name << "' from " << source->columns << "x" << source->rows << " image");
+        Image* images;
+        if (source == cascade && !cascadeNeeded) {
+            images = cascade;
+            cascade = NULL;
+        } else if (source == base && lastUse) {
+            images = base;
+            base = NULL;
+        } else {
+            images = copyForActions(source, r.actions, first);
+        }
+        if (images) {
+            images = runTransformations(images, r.actions, first, quality, r.error);
+        } else {
+            r.error.append("couldn't copy image");
+        }
+        if (!images) {
+            continue;
+        }
+        r.orig_x = images->magick_columns;
+        r.orig_y = images->magick_rows;
+        r.x = images->columns;
+        r.y = images->rows;
+        ImageInfo* info = CloneImageInfo(image_info);
+        info->quality = quality;
+        r.path = IP_Write(info, images, inPath, tmpDir, r.outputFormat, r.error);
+        DestroyImageInfo(info);
+        DestroyImageList(images);
+    }
+    if (cascade) {
+        DestroyImageList(cascade);
+    }
+    if (base) {
+        DestroyImageList(base);
     }
-    DestroyImage(images);
     DestroyImageInfo(image_info);
-    image_info = NULL;
-    DestroyExceptionInfo(&exception);
-    return rv;
+    return true;
 }
@@ -34,13 +34,33 @@
 #define __IMAGEPROCESSOR_HH__
 
 #include <string>
+#include <vector>
 #include "bpservice/bpservice.h"
+#include "Actions.hh"
 
 namespace imageproc {
     /** once per process initialization */
     void init();
     /** once per process shutdown */
     void shutdown();
+    class OutputCache;
+    /** remember the results of ChangeImage in cache, and return them
+     *  rather than transforming the same input the same way again.
+     *  NULL (the default) turns caching off.  Not to be changed while
+     *  images are being transformed. */
+    void SetOutputCache(OutputCache* cache);
+    class SourceCache;
+    /** reuse decoded inputs held in cache rather than decoding the same
+     *  file again.  NULL (the default) turns this off.  Not to be changed
+     *  while images are being transformed. */
+    void SetSourceCache(SourceCache* cache);
+    class MemoryBudget;
+    /** reserve the memory each transform is estimated to need from
+     *  budget before decoding, waiting for or refusing those that don't
+     *  fit.  NULL (the default) means no limit.  Not to be changed while
+     *  images are being transformed. */
+    void SetMemoryBudget(MemoryBudget* budget);
+    class Profile;
     // image type is a short text string
     typedef const char* Type;
     extern const Type UNKNOWN;
@@ -58,6 +78,11 @@ namespace imageproc {
      *  y - the vertical dimension of the resultant image
      *  orig_x - the horizontal dimension of the original image
      *  orig_y - the vertical dimension of the original image
+     *  allFrames - transform every frame of an animated image, rather
+     *              than keeping only the first.  Frames are transformed
+     *              in parallel.  Without actions every frame is kept
+     *              either way.
+     *  profile - if given, where the time and memory each stage took
      *  \returns .empty() on error, otherwise the path to resulting image
      */
     std::string ChangeImage(const std::string& inPath,
@@ -69,6 +94,71 @@ namespace imageproc {
                             unsigned int& y,
                             unsigned int& orig_x,
                             unsigned int& orig_y,
-                            std::string& error);
+                            std::string& error,
+                            bool allFrames = false,
+                            Profile* profile = NULL);
+    /** as above, with actions that have already been parsed (and
+     *  probably optimized).  Many images may be processed with the same
+     *  actions at once. */
+    std::string ChangeImage(const std::string& inPath,
+                            const std::string& tmpdir,
+                            Type outputFormat,
+                            const trans::ActionList& actions,
+                            int quality,
+                            unsigned int& x,
+                            unsigned int& y,
+                            unsigned int& orig_x,
+                            unsigned int& orig_y,
+                            std::string& error,
+                            bool allFrames = false,
+                            Profile* profile = NULL);
+    /** what the headers of an image reveal */
+    struct Info {
+        // GraphicsMagick's name for the format, e.g. "JPEG"
+        std::string format;
+        unsigned int width;
+        unsigned int height;
+        unsigned int frames;
+        // "rgb", "gray", "palette" or "cmyk", with an "a" appended if
+        // there's an alpha channel
+        std::string colorType;
+        // bits per sample
+        unsigned int depth;
+        // the EXIF orientation (1-8), 0 if there's none
+        unsigned int orientation;
+    };
+    /** describe the image at inPath by reading only its headers, no
+     *  pixels are decoded.
+     *  \returns false and populates error if it can't be read */
+    bool GetInfo(const std::string& inPath, Info& info, std::string& error);
+    /** one of several outputs made from a single read of an image */
+    struct Rendition {
+        // supplied by the caller
+        std::string name;
+        trans::ActionList actions;
+        Type outputFormat;
+        int quality;
+        // filled in by MakeRenditions, path is .empty() and error set
+        // on failure.  as for ChangeImage.
+        std::string path;
+        unsigned int x;
+        unsigned int y;
+        unsigned int orig_x;
+        unsigned int orig_y;
+        std::string error;
+    };
+    /** read the image at inPath once, perform the prefix actions on it
+     *  once, then make each rendition from the result.  Renditions
+     *  which begin with a scale or thumbnail are made largest first,
+     *  each scaled from the previous one's scaled image rather than
+     *  the full size image.
+     *  \returns false and populates error if the image couldn't be
+     *           read or the prefix actions failed, otherwise true with
+     *           results (or errors) in each rendition */
+    bool MakeRenditions(const std::string& inPath,
+                        const std::string& tmpdir,
+                        const trans::ActionList& prefix,
+                        std::vector<Rendition>& renditions,
+                        std::string& error);
 };
 #endif
@@ -0,0 +1,199 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "InputFile.hh"
+#include "Trace.hh"
+#include "bpservice/bpservice.h"
+#include "bp-file/bpfile.h"
+#include <boost/filesystem.hpp>
+#include <sstream>
+#include <stdlib.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// setting up a mapping costs more than copying a small file
+#define IF_MAP_MIN_BYTES (64 * 1024)
+
+imageproc::InputFile::InputFile()
+    : m_data(NULL), m_size(0), m_mapped(false)
+{
+}
+
+imageproc::InputFile::~InputFile() {
+    close();
+}
+
+bool
+imageproc::InputFile::open(const std::string& path) {
+    IA_TRACE_SCOPE("read");
+    close();
+    if (path.empty()) {
+        return false;
+    }
+    boost::system::error_code ec;
+    boost::uintmax_t len = boost::filesystem::file_size(path, ec);
+    if (!ec && len >= IF_MAP_MIN_BYTES && map(path)) {
+        IA_LOG(BP_INFO, "mapped " << m_size << " bytes of '" << path << "'");
+        return true;
+    }
+    return read(path);
+}
+
+#ifdef WIN32
+
+bool
+imageproc::InputFile::map(const std::string& path) {
+    HANDLE file = CreateFileW(boost::filesystem::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER len;
+    if (!GetFileSizeEx(file, &len) || len.QuadPart <= 0 ||
+        (unsigned long long)len.QuadPart > (size_t)-1) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) {
+        return false;
+    }
+    // the view keeps the mapping alive
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (view == NULL) {
+        return false;
+    }
+    m_data = view;
+    m_size = (size_t)len.QuadPart;
+    m_mapped = true;
+    return true;
+}
+
+#else
+
+bool
+imageproc::InputFile::map(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+        (unsigned long long)st.st_size > (size_t)-1) {
+        ::close(fd);
+        return false;
+    }
+    // the mapping outlives the descriptor
+    void* addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    m_data = addr;
+    m_size = (size_t)st.st_size;
+    m_mapped = true;
+    return true;
+}
+
+#endif
+
+bool
+imageproc::InputFile::read(const std::string& path) {
+    std::stringstream ss;
+    std::ifstream fstream;
+    if (!bp::file::openReadableStream(fstream, path, std::ios_base::in | std::ios_base::binary)) {
+        ss.str("");
+        ss << "Couldn't open file for reading: " << path;
+        bplus::service::Service::log(BP_ERROR, ss.str());
+        return false;
+    }
+    // get filesize
+    fstream.seekg(0, std::ios::end);
+    size_t len = (size_t)fstream.tellg();
+    fstream.seekg(0, std::ios::beg);
+    IA_LOG(BP_DEBUG, "file size = " << len);
+    if (len <= 0) {
+        ss.str("");
+        ss << "Couldn't determine file length: " << path;
+        bplus::service::Service::log(BP_ERROR, ss.str());
+        return false;
+    }
+    void* img = malloc(len);
+    if (img == NULL) {
+        ss.str("");
+        ss << "memory allocation failed (" << len << " bytes) when trying to read image";
+        bplus::service::Service::log(BP_ERROR, ss.str());
+        return false;
+    }
+    IA_LOG(BP_INFO, "Attempting to read " << len << " bytes from '" << path << "'");
+    fstream.read((char*)img, len);
+    size_t rd = (size_t)fstream.gcount();
+    fstream.close();
+    if (rd != len) {
+        ss.str("");
+        ss << "Partial read detected, got " << rd << " of " << len << " bytes";
+        bplus::service::Service::log(BP_ERROR, ss.str());
+        free(img);
+        return false;
+    }
+    m_data = img;
+    m_size = len;
+    m_mapped = false;
+    return true;
+}
+
+void
+imageproc::InputFile::close() {
+    if (m_data == NULL) {
+        return;
+    }
+    if (!m_mapped) {
+        free(m_data);
+    } else {
+#ifdef WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap(m_data, m_size);
+#endif
+    }
+    m_data = NULL;
+    m_size = 0;
+    m_mapped = false;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The bytes of an input image.  Where the platform allows the file is
+ * mapped read-only and decoded straight from the mapping, otherwise it
+ * is read into the heap.
+ */
+
+#ifndef __INPUTFILE_HH__
+#define __INPUTFILE_HH__
+
+#include <string>
+#include <stddef.h>
+
+namespace imageproc {
+    class InputFile {
+    public:
+        InputFile();
+        /** unmaps or frees the contents */
+        ~InputFile();
+        /** map or read the file at path.  returns false (having logged
+         *  why) if it can't be opened or is empty */
+        bool open(const std::string& path);
+        /** the contents of the file, NULL until opened */
+        const void* data() const { return m_data; }
+        size_t size() const { return m_size; }
+        /** release the contents before destruction */
+        void close();
+    private:
+        bool map(const std::string& path);
+        bool read(const std::string& path);
+        InputFile(const InputFile&);
+        InputFile& operator=(const InputFile&);
+
+        void* m_data;
+        size_t m_size;
+        bool m_mapped;
+    };
+};
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "JPEGRegion.hh"
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+extern "C" {
+#include <jpeglib.h>
+}
+
+// libjpeg reports fatal errors by calling error_exit, which we turn
+// into a longjmp back to ReadJPEGRegion
+struct RegionErrorManager {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+static void
+regionErrorExit(j_common_ptr cinfo) {
+    RegionErrorManager* err = (RegionErrorManager*)cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+static void
+regionOutputMessage(j_common_ptr cinfo) {
+    // warnings (i.e. premature end of data) are not interesting here
+}
+
+// a source manager reading from a buffer in memory (jpeg_mem_src isn't
+// available in every libjpeg we build against)
+static void
+regionInitSource(j_decompress_ptr cinfo) {
+}
+
+static boolean
+regionFillInputBuffer(j_decompress_ptr cinfo) {
+    // out of data, insert a fake EOI marker as libjpeg suggests
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+static void
+regionSkipInputData(j_decompress_ptr cinfo, long num_bytes) {
+    if (num_bytes <= 0) {
+        return;
+    }
+    if ((size_t)num_bytes > cinfo->src->bytes_in_buffer) {
+        (void)regionFillInputBuffer(cinfo);
+    } else {
+        cinfo->src->next_input_byte += num_bytes;
+        cinfo->src->bytes_in_buffer -= num_bytes;
+    }
+}
+
+static void
+regionTermSource(j_decompress_ptr cinfo) {
+}
+
+// GraphicsMagick's JPEG reader keeps libjpeg's decompression defaults
+// except where the jpeg:block-smoothing, jpeg:dct-method and
+// jpeg:fancy-upsampling definitions override them.  We must do exactly
+// the same for the region to hold the pixels a full decode would.
+static void
+regionDecompressParameters(j_decompress_ptr cinfo, const ImageInfo* image_info) {
+    const char* value = AccessDefinition(image_info, "jpeg", "block-smoothing");
+    if (value) {
+        cinfo->do_block_smoothing = LocaleCompare(value, "FALSE") ? TRUE : FALSE;
+    }
+    value = AccessDefinition(image_info, "jpeg", "dct-method");
+    if (value) {
+        if (LocaleCompare(value, "ISLOW") == 0) {
+            cinfo->dct_method = JDCT_ISLOW;
+        } else if (LocaleCompare(value, "IFAST") == 0) {
+            cinfo->dct_method = JDCT_IFAST;
+        } else if (LocaleCompare(value, "FLOAT") == 0) {
+            cinfo->dct_method = JDCT_FLOAT;
+        } else if (LocaleCompare(value, "DEFAULT") == 0) {
+            cinfo->dct_method = JDCT_DEFAULT;
+        } else if (LocaleCompare(value, "FASTEST") == 0) {
+            cinfo->dct_method = JDCT_FASTEST;
+        }
+    }
+    value = AccessDefinition(image_info, "jpeg", "fancy-upsampling");
+    if (value) {
+        cinfo->do_fancy_upsampling = LocaleCompare(value, "FALSE") ? TRUE : FALSE;
+    }
+}
+
+Image*
+imageproc::ReadJPEGRegion(const ImageInfo* image_info, const Image* header,
+                          const void* blob, size_t len,
+                          const RectangleInfo& region, ExceptionInfo* exception) {
+    // a size hint would have GraphicsMagick decode at reduced scale
+    if (image_info->size != NULL) {
+        return NULL;
+    }
+    if (region.width == 0 || region.height == 0 ||
+        region.x < 0 || region.y < 0 ||
+        region.x + region.width > header->columns ||
+        region.y + region.height > header->rows) {
+        return NULL;
+    }
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_source_mgr src;
+    RegionErrorManager jerr;
+    Image* volatile image = NULL;
+    memset(&cinfo, 0, sizeof(cinfo));
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = regionErrorExit;
+    jerr.pub.output_message = regionOutputMessage;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        if (image) {
+            DestroyImage(image);
+        }
+        return NULL;
+    }
+    jpeg_create_decompress(&cinfo);
+    src.next_input_byte = (const JOCTET*)blob;
+    src.bytes_in_buffer = len;
+    src.init_source = regionInitSource;
+    src.fill_input_buffer = regionFillInputBuffer;
+    src.skip_input_data = regionSkipInputData;
+    src.resync_to_restart = jpeg_resync_to_restart;
+    src.term_source = regionTermSource;
+    cinfo.src = &src;
+    (void)jpeg_read_header(&cinfo, TRUE);
+    // we only handle the common 8 bit color case, anything else takes
+    // the normal route through GraphicsMagick
+    if (cinfo.data_precision != 8 || cinfo.num_components != 3 ||
+        (cinfo.jpeg_color_space != JCS_YCbCr && cinfo.jpeg_color_space != JCS_RGB)) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    cinfo.out_color_space = JCS_RGB;
+    regionDecompressParameters(&cinfo, image_info);
+    (void)jpeg_start_decompress(&cinfo);
+    if (cinfo.output_width != header->columns || cinfo.output_height != header->rows ||
+        cinfo.output_components != 3) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    image = CloneImage(header, region.width, region.height, 1, exception);
+    if (!image) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    image->storage_class = DirectClass;
+    image->magick_columns = header->columns;
+    image->magick_rows = header->rows;
+    JSAMPARRAY row = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE,
+                                                cinfo.output_width * 3, 1);
+#ifdef LIBJPEG_TURBO_VERSION_NUMBER
+    // libjpeg-turbo can skip the rows above the region without
+    // producing them
+    if (region.y > 0) {
+        (void)jpeg_skip_scanlines(&cinfo, region.y);
+    }
+#endif
+    while (cinfo.output_scanline < (JDIMENSION)region.y) {
+        (void)jpeg_read_scanlines(&cinfo, row, 1);
+    }
+    for (unsigned long y = 0; y < region.height; y++) {
+        if (jpeg_read_scanlines(&cinfo, row, 1) != 1) {
+            break;
+        }
+        PixelPacket* q = SetImagePixels(image, 0, (long)y, region.width, 1);
+        if (!q) {
+            break;
+        }
+        const JSAMPLE* p = row[0] + region.x * 3;
+        for (unsigned long x = 0; x < region.width; x++) {
+            q->red = ScaleCharToQuantum(GETJSAMPLE(*p++));
+            q->green = ScaleCharToQuantum(GETJSAMPLE(*p++));
+            q->blue = ScaleCharToQuantum(GETJSAMPLE(*p++));
+            q->opacity = OpaqueOpacity;
+            q++;
+        }
+        if (!SyncImagePixels(image)) {
+            break;
+        }
+    }
+    bool complete = (cinfo.output_scanline == (JDIMENSION)(region.y + region.height));
+    // everything below the region is simply never decoded
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    if (!complete) {
+        DestroyImage(image);
+        return NULL;
+    }
+    return image;
+}
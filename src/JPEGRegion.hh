@@ -0,0 +1,59 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decoding of a rectangular region of a JPEG image straight from
+ * libjpeg, used when a pipeline begins with a crop.
+ */
+
+#ifndef __JPEGREGION_HH__
+#define __JPEGREGION_HH__
+
+#include <stddef.h>
+#include <magick/api.h>
+
+namespace imageproc {
+    /** decode only the pixels within region from the JPEG image in blob.
+     *  header is the result of pinging the same blob and supplies the
+     *  non-pixel properties (profiles, resolution, ...) of the result.
+     *  libjpeg is set up as GraphicsMagick's reader would set it up for
+     *  image_info, so the pixels are those a full decode would give.
+     *  Rows after the region are never decoded, and with libjpeg-turbo
+     *  neither are the rows before it.
+     *  \returns NULL if the JPEG isn't one this reader handles (the
+     *           caller should fall back to a full decode) */
+    Image* ReadJPEGRegion(const ImageInfo* image_info, const Image* header,
+                          const void* blob, size_t len,
+                          const RectangleInfo& region, ExceptionInfo* exception);
+};
+
+#endif
@@ -0,0 +1,331 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Json.hh"
+#include <sstream>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#define strtoll _strtoi64
+#endif
+
+// deeper than this is surely a mistake, and would exhaust the stack
+#define JSON_MAX_DEPTH 64
+
+namespace {
+    class Parser {
+    public:
+        Parser(const std::string& text) : m_text(text), m_pos(0) { }
+        bplus::Object* parse(std::string& oError);
+    private:
+        bplus::Object* value(unsigned int depth);
+        bplus::Object* object(unsigned int depth);
+        bplus::Object* array(unsigned int depth);
+        bplus::Object* number();
+        bool string(std::string& s);
+        bool literal(const char* word);
+        void skipSpace();
+        bool fail(const char* why);
+
+        const std::string& m_text;
+        size_t m_pos;
+        std::string m_error;
+    };
+}
+
+bplus::Object*
+Parser::parse(std::string& oError) {
+    bplus::Object* v = value(0);
+    skipSpace();
+    if (v && m_pos != m_text.size()) {
+        delete v;
+        v = NULL;
+        fail("trailing characters");
+    }
+    if (!v) {
+        std::stringstream ss;
+        ss << "invalid JSON at offset " << m_pos << ": " << m_error;
+        oError.append(ss.str());
+    }
+    return v;
+}
+
+bool
+Parser::fail(const char* why) {
+    if (m_error.empty()) {
+        m_error = why;
+    }
+    return false;
+}
+
+void
+Parser::skipSpace() {
+    while (m_pos < m_text.size() && strchr(" \t\r\n", m_text[m_pos])) {
+        m_pos++;
+    }
+}
+
+bool
+Parser::literal(const char* word) {
+    size_t n = strlen(word);
+    if (m_text.compare(m_pos, n, word) != 0) {
+        return fail("unexpected character");
+    }
+    m_pos += n;
+    return true;
+}
+
+bplus::Object*
+Parser::value(unsigned int depth) {
+    if (depth > JSON_MAX_DEPTH) {
+        fail("nested too deeply");
+        return NULL;
+    }
+    skipSpace();
+    if (m_pos == m_text.size()) {
+        fail("unexpected end of input");
+        return NULL;
+    }
+    char c = m_text[m_pos];
+    std::string s;
+    switch (c) {
+        case '{':
+            return object(depth);
+        case '[':
+            return array(depth);
+        case '"':
+            return string(s) ? new bplus::String(s) : NULL;
+        case 't':
+            return literal("true") ? new bplus::Bool(true) : NULL;
+        case 'f':
+            return literal("false") ? new bplus::Bool(false) : NULL;
+        case 'n':
+            return literal("null") ? new bplus::Null : NULL;
+        default:
+            return number();
+    }
+}
+
+bplus::Object*
+Parser::object(unsigned int depth) {
+    bplus::Map* m = new bplus::Map;
+    m_pos++;
+    skipSpace();
+    if (m_pos < m_text.size() && m_text[m_pos] == '}') {
+        m_pos++;
+        return m;
+    }
+    for (;;) {
+        std::string key;
+        skipSpace();
+        if (m_pos == m_text.size() || m_text[m_pos] != '"') {
+            fail("expected a property name");
+            break;
+        }
+        if (!string(key)) {
+            break;
+        }
+        skipSpace();
+        if (m_pos == m_text.size() || m_text[m_pos] != ':') {
+            fail("expected ':'");
+            break;
+        }
+        m_pos++;
+        bplus::Object* v = value(depth + 1);
+        if (!v) {
+            break;
+        }
+        m->add(key, v);
+        skipSpace();
+        if (m_pos < m_text.size() && m_text[m_pos] == ',') {
+            m_pos++;
+        } else if (m_pos < m_text.size() && m_text[m_pos] == '}') {
+            m_pos++;
+            return m;
+        } else {
+            fail("expected ',' or '}'");
+            break;
+        }
+    }
+    delete m;
+    return NULL;
+}
+
+bplus::Object*
+Parser::array(unsigned int depth) {
+    bplus::List* l = new bplus::List;
+    m_pos++;
+    skipSpace();
+    if (m_pos < m_text.size() && m_text[m_pos] == ']') {
+        m_pos++;
+        return l;
+    }
+    for (;;) {
+        bplus::Object* v = value(depth + 1);
+        if (!v) {
+            break;
+        }
+        l->append(v);
+        skipSpace();
+        if (m_pos < m_text.size() && m_text[m_pos] == ',') {
+            m_pos++;
+        } else if (m_pos < m_text.size() && m_text[m_pos] == ']') {
+            m_pos++;
+            return l;
+        } else {
+            fail("expected ',' or ']'");
+            break;
+        }
+    }
+    delete l;
+    return NULL;
+}
+
+bplus::Object*
+Parser::number() {
+    size_t start = m_pos;
+    bool integral = true;
+    if (m_pos < m_text.size() && m_text[m_pos] == '-') {
+        m_pos++;
+    }
+    size_t digits = m_pos;
+    while (m_pos < m_text.size() && isdigit((unsigned char)m_text[m_pos])) {
+        m_pos++;
+    }
+    if (m_pos == digits) {
+        fail("unexpected character");
+        return NULL;
+    }
+    while (m_pos < m_text.size() && strchr("0123456789.eE+-", m_text[m_pos])) {
+        integral = false;
+        m_pos++;
+    }
+    std::string n = m_text.substr(start, m_pos - start);
+    char* end = NULL;
+    if (integral) {
+        long long v = strtoll(n.c_str(), &end, 10);
+        return new bplus::Integer(v);
+    }
+    double d = strtod(n.c_str(), &end);
+    if (end == NULL || *end != '\0') {
+        fail("malformed number");
+        return NULL;
+    }
+    return new bplus::Double(d);
+}
+
+// append code point cp to s as UTF-8
+static void
+appendUtf8(std::string& s, unsigned long cp) {
+    if (cp < 0x80) {
+        s.append(1, (char)cp);
+    } else if (cp < 0x800) {
+        s.append(1, (char)(0xc0 | (cp >> 6)));
+        s.append(1, (char)(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+        s.append(1, (char)(0xe0 | (cp >> 12)));
+        s.append(1, (char)(0x80 | ((cp >> 6) & 0x3f)));
+        s.append(1, (char)(0x80 | (cp & 0x3f)));
+    } else {
+        s.append(1, (char)(0xf0 | (cp >> 18)));
+        s.append(1, (char)(0x80 | ((cp >> 12) & 0x3f)));
+        s.append(1, (char)(0x80 | ((cp >> 6) & 0x3f)));
+        s.append(1, (char)(0x80 | (cp & 0x3f)));
+    }
+}
+
+bool
+Parser::string(std::string& s) {
+    m_pos++;
+    while (m_pos < m_text.size()) {
+        char c = m_text[m_pos++];
+        if (c == '"') {
+            return true;
+        }
+        if ((unsigned char)c < 0x20) {
+            return fail("control character in string");
+        }
+        if (c != '\\') {
+            s.append(1, c);
+            continue;
+        }
+        if (m_pos == m_text.size()) {
+            break;
+        }
+        c = m_text[m_pos++];
+        switch (c) {
+            case '"': case '\\': case '/':
+                s.append(1, c);
+                break;
+            case 'b': s.append(1, '\b'); break;
+            case 'f': s.append(1, '\f'); break;
+            case 'n': s.append(1, '\n'); break;
+            case 'r': s.append(1, '\r'); break;
+            case 't': s.append(1, '\t'); break;
+            case 'u': {
+                if (m_pos + 4 > m_text.size()) {
+                    return fail("truncated \\u escape");
+                }
+                std::string hex = m_text.substr(m_pos, 4);
+                char* end = NULL;
+                unsigned long cp = strtoul(hex.c_str(), &end, 16);
+                if (*end != '\0') {
+                    return fail("malformed \\u escape");
+                }
+                m_pos += 4;
+                // a surrogate pair encodes one code point beyond the BMP
+                if (cp >= 0xd800 && cp < 0xdc00 && m_text.compare(m_pos, 2, "\\u") == 0 &&
+                    m_pos + 6 <= m_text.size()) {
+                    hex = m_text.substr(m_pos + 2, 4);
+                    unsigned long low = strtoul(hex.c_str(), &end, 16);
+                    if (*end == '\0' && low >= 0xdc00 && low < 0xe000) {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        m_pos += 6;
+                    }
+                }
+                appendUtf8(s, cp);
+                break;
+            }
+            default:
+                return fail("unknown escape");
+        }
+    }
+    return fail("unterminated string");
+}
+
+bplus::Object*
+imageproc::parseJson(const std::string& text, std::string& oError) {
+    Parser p(text);
+    return p.parse(oError);
+}
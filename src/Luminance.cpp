@@ -0,0 +1,123 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Luminance.hh"
+#include "ColorMatrix.hh"
+
+#if defined(IA_X86_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define IA_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// the same constants as PixelIntensityRec601() / PixelIntensityRec709()
+static const double s_rec601[3] = { 0.299, 0.587, 0.114 };
+static const double s_rec709[3] = { 0.2126, 0.7152, 0.0722 };
+
+const double*
+trans::lumaWeights(Luma luma) {
+    return luma == Rec709Luma ? s_rec709 : s_rec601;
+}
+
+double
+trans::lumaBias() {
+    // depending on the GraphicsMagick release PixelIntensityToQuantum()
+    // either truncates or rounds.  A pure green of 1 has an intensity
+    // of .587, which tells us which.
+    PixelPacket p;
+    p.red = p.blue = p.opacity = 0;
+    p.green = 1;
+    return PixelIntensityToQuantum(&p) ? 0.5 : 0.0;
+}
+
+void
+trans::luminanceScalar(const double weights[3], double bias, PixelPacket* pixels, unsigned long n) {
+    for (unsigned long i = 0; i < n; i++) {
+        PixelPacket* p = pixels + i;
+        Quantum q = (Quantum)(weights[0] * p->red + weights[1] * p->green + weights[2] * p->blue + bias);
+        p->red = p->green = p->blue = q;
+    }
+}
+
+static const double s_bias = trans::lumaBias();
+
+void
+trans::applyLuminance(Luma luma, PixelPacket* pixels, unsigned long n) {
+    // Rec.709's weights sum to a hair under one in doubles, so a
+    // truncating bias would turn white into 254 and shift gray input.
+    // Only Rec.601 has to match GraphicsMagick, so 709 always rounds.
+    double bias = luma == Rec709Luma ? 0.5 : s_bias;
+    KernelRegistry<LuminanceKernel>::instance().best().func(lumaWeights(luma), bias, pixels, n);
+}
+
+static trans::KernelRegistrar<trans::LuminanceKernel>
+s_scalar("scalar", 0, NULL, trans::luminanceScalar);
+
+// defined in LuminanceAVX2.cpp, see ColorMatrix.cpp
+static trans::KernelRegistrar<trans::LuminanceKernel>
+s_avx2("avx2", 20, trans::cpuHasAVX2, trans::luminanceAVX2);
+
+#ifdef IA_HAVE_SSE2
+// four pixels at a time, see colorMatrixSSE2
+static void
+luminanceSSE2(const double weights[3], double bias, PixelPacket* pixels, unsigned long n) {
+    const __m128d wr = _mm_set1_pd(weights[0]);
+    const __m128d wg = _mm_set1_pd(weights[1]);
+    const __m128d wb = _mm_set1_pd(weights[2]);
+    const __m128d vbias = _mm_set1_pd(bias);
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    const __m128i opacityMask = _mm_set1_epi32((int)0xff000000);
+    unsigned long i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pixels + i));
+        __m128i b = _mm_and_si128(v, byteMask);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), byteMask);
+        __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), byteMask);
+        __m128d lo = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(wr, _mm_cvtepi32_pd(r)),
+                                                      _mm_mul_pd(wg, _mm_cvtepi32_pd(g))),
+                                           _mm_mul_pd(wb, _mm_cvtepi32_pd(b))),
+                                vbias);
+        __m128d hi = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(wr, _mm_cvtepi32_pd(_mm_srli_si128(r, 8))),
+                                                      _mm_mul_pd(wg, _mm_cvtepi32_pd(_mm_srli_si128(g, 8)))),
+                                           _mm_mul_pd(wb, _mm_cvtepi32_pd(_mm_srli_si128(b, 8)))),
+                                vbias);
+        __m128i q = _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+        __m128i res = _mm_or_si128(_mm_and_si128(v, opacityMask), q);
+        res = _mm_or_si128(res, _mm_slli_epi32(q, 8));
+        res = _mm_or_si128(res, _mm_slli_epi32(q, 16));
+        _mm_storeu_si128((__m128i*)(pixels + i), res);
+    }
+    trans::luminanceScalar(weights, bias, pixels + i, n - i);
+}
+
+static trans::KernelRegistrar<trans::LuminanceKernel>
+s_sse2("sse2", 10, trans::cpuHasSSE2, luminanceSSE2);
+#endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The luminance kernel: every pixel is replaced with the gray level
+ * of its weighted intensity, w[0] * r + w[1] * g + w[2] * b.
+ *
+ * With Rec.601 weights this is exactly GraphicsMagick's
+ * PixelIntensityToQuantum(), which is what converting to the GRAY
+ * colorspace does.  Rec.709 always rounds, so gray input is left
+ * unchanged.  All implementations compute the same thing (see
+ * ColorMatrix.hh), so which one runs never changes the output.
+ */
+
+#ifndef __LUMINANCE_HH__
+#define __LUMINANCE_HH__
+
+#include <magick/api.h>
+#include "SIMD.hh"
+
+namespace trans {
+    /** the weightings we know */
+    enum Luma {
+        Rec601Luma,
+        Rec709Luma
+    };
+    /** tag for the luminance kernel's registry.  bias is added before
+     *  truncating to a Quantum */
+    struct LuminanceKernel {
+        typedef void (*Func)(const double weights[3], double bias, PixelPacket* pixels, unsigned long n);
+    };
+    /** the red, green and blue weights for luma */
+    const double* lumaWeights(Luma luma);
+    /** the value GraphicsMagick adds to an intensity before truncating
+     *  it to a Quantum, 0.5 if it rounds and 0 if it doesn't */
+    double lumaBias();
+    /** the portable implementation */
+    void luminanceScalar(const double weights[3], double bias, PixelPacket* pixels, unsigned long n);
+    /** convert n pixels to gray with the best variant this CPU
+     *  supports.  Rec.601 uses lumaBias(), Rec.709 rounds. */
+    void applyLuminance(Luma luma, PixelPacket* pixels, unsigned long n);
+    /** the AVX2 implementation, NULL where it can't be built.  It's
+     *  registered from Luminance.cpp, see SIMD.hh. */
+    extern const LuminanceKernel::Func luminanceAVX2;
+};
+
+#endif
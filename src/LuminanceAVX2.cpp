@@ -0,0 +1,88 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The AVX2 luminance kernel, built with AVX2 code generation enabled
+ * and only run on CPUs that support it.  Nothing else may live here,
+ * see SIMD.hh.
+ */
+
+#include "Luminance.hh"
+#include "ColorMatrix.hh"
+
+#if defined(IA_X86_SIMD) && (defined(__AVX2__) || defined(_MSC_VER))
+#include <immintrin.h>
+
+static inline __m256d
+intensity(__m256d wr, __m256d wg, __m256d wb, __m256d bias, __m128i r, __m128i g, __m128i b) {
+    return _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(wr, _mm256_cvtepi32_pd(r)),
+                                                     _mm256_mul_pd(wg, _mm256_cvtepi32_pd(g))),
+                                       _mm256_mul_pd(wb, _mm256_cvtepi32_pd(b))),
+                         bias);
+}
+
+// eight pixels at a time, see colorMatrixSSE2
+static void
+luminanceAVX2(const double weights[3], double bias, PixelPacket* pixels, unsigned long n) {
+    const __m256d wr = _mm256_set1_pd(weights[0]);
+    const __m256d wg = _mm256_set1_pd(weights[1]);
+    const __m256d wb = _mm256_set1_pd(weights[2]);
+    const __m256d vbias = _mm256_set1_pd(bias);
+    const __m256i byteMask = _mm256_set1_epi32(0xff);
+    const __m256i opacityMask = _mm256_set1_epi32((int)0xff000000);
+    unsigned long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pixels + i));
+        __m256i b = _mm256_and_si256(v, byteMask);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 8), byteMask);
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(v, 16), byteMask);
+        __m128i lo = _mm256_cvttpd_epi32(intensity(wr, wg, wb, vbias,
+                                                   _mm256_castsi256_si128(r),
+                                                   _mm256_castsi256_si128(g),
+                                                   _mm256_castsi256_si128(b)));
+        __m128i hi = _mm256_cvttpd_epi32(intensity(wr, wg, wb, vbias,
+                                                   _mm256_extracti128_si256(r, 1),
+                                                   _mm256_extracti128_si256(g, 1),
+                                                   _mm256_extracti128_si256(b, 1)));
+        __m256i q = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        __m256i res = _mm256_or_si256(_mm256_and_si256(v, opacityMask), q);
+        res = _mm256_or_si256(res, _mm256_slli_epi32(q, 8));
+        res = _mm256_or_si256(res, _mm256_slli_epi32(q, 16));
+        _mm256_storeu_si256((__m256i*)(pixels + i), res);
+    }
+    trans::luminanceScalar(weights, bias, pixels + i, n - i);
+}
+
+const trans::LuminanceKernel::Func trans::luminanceAVX2 = ::luminanceAVX2;
+#else
+const trans::LuminanceKernel::Func trans::luminanceAVX2 = NULL;
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MemoryBudget.hh"
+#include "bpservice/bpservice.h"
+#include <sstream>
+
+imageproc::MemoryBudget::MemoryBudget(boost::uintmax_t budget, unsigned int waitSeconds)
+    : m_budget(budget), m_reserved(0), m_waitSeconds(waitSeconds)
+{
+}
+
+bool
+imageproc::MemoryBudget::acquire(boost::uintmax_t bytes, std::string& oError) {
+    std::stringstream ss;
+    if (bytes > m_budget) {
+        ss << "image needs an estimated " << (bytes >> 20) << "MB, more than the "
+           << (m_budget >> 20) << "MB allowed";
+        bplus::service::Service::log(BP_WARN, ss.str());
+        oError.append("image too large to process");
+        return false;
+    }
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(m_waitSeconds);
+    boost::mutex::scoped_lock lock(m_lock);
+    while (m_reserved + bytes > m_budget) {
+        if (!m_released.timed_wait(lock, deadline)) {
+            if (m_reserved + bytes <= m_budget) {
+                break;
+            }
+            ss << "gave up waiting for " << (bytes >> 20) << "MB, "
+               << (m_reserved >> 20) << "MB of " << (m_budget >> 20) << "MB in use";
+            bplus::service::Service::log(BP_WARN, ss.str());
+            oError.append("not enough memory to process image, try again later");
+            return false;
+        }
+    }
+    m_reserved += bytes;
+    return true;
+}
+
+void
+imageproc::MemoryBudget::release(boost::uintmax_t bytes) {
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        m_reserved -= bytes;
+    }
+    m_released.notify_all();
+}
+
+boost::uintmax_t
+imageproc::MemoryBudget::budget() const {
+    return m_budget;
+}
+
+imageproc::MemoryBudget::Reservation::Reservation()
+    : m_budget(NULL), m_bytes(0)
+{
+}
+
+imageproc::MemoryBudget::Reservation::~Reservation() {
+    if (m_budget) {
+        m_budget->release(m_bytes);
+    }
+}
+
+bool
+imageproc::MemoryBudget::Reservation::acquire(MemoryBudget* budget, boost::uintmax_t bytes,
+                                              std::string& oError) {
+    if (budget == NULL) {
+        return true;
+    }
+    if (!budget->acquire(bytes, oError)) {
+        return false;
+    }
+    m_budget = budget;
+    m_bytes = bytes;
+    return true;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Admission control: transforms reserve their estimated peak memory
+ * from a process wide budget before decoding, so a few huge images
+ * can't push the host into swap.
+ */
+
+#ifndef __MEMORYBUDGET_HH__
+#define __MEMORYBUDGET_HH__
+
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+
+namespace imageproc {
+    class MemoryBudget {
+    public:
+        /** allow budget bytes to be reserved at once.  A reservation
+         *  which doesn't fit waits up to waitSeconds for others to be
+         *  released. */
+        MemoryBudget(boost::uintmax_t budget, unsigned int waitSeconds);
+        /** reserve bytes.  Fails at once if bytes exceeds the whole
+         *  budget, and after the wait if it doesn't become available.
+         *  \returns false and populates oError on failure */
+        bool acquire(boost::uintmax_t bytes, std::string& oError);
+        /** return bytes reserved with acquire() */
+        void release(boost::uintmax_t bytes);
+        boost::uintmax_t budget() const;
+
+        /** a reservation released on destruction */
+        class Reservation {
+        public:
+            Reservation();
+            ~Reservation();
+            /** reserve bytes from budget, which may be NULL (no limit) */
+            bool acquire(MemoryBudget* budget, boost::uintmax_t bytes, std::string& oError);
+        private:
+            Reservation(const Reservation&);
+            Reservation& operator=(const Reservation&);
+
+            MemoryBudget* m_budget;
+            boost::uintmax_t m_bytes;
+        };
+    private:
+        MemoryBudget(const MemoryBudget&);
+        MemoryBudget& operator=(const MemoryBudget&);
+
+        boost::uintmax_t m_budget;
+        boost::uintmax_t m_reserved;
+        unsigned int m_waitSeconds;
+        boost::mutex m_lock;
+        // signalled when bytes are released
+        boost::condition_variable m_released;
+    };
+};
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "OutputCache.hh"
+#include "Trace.hh"
+#include "bpservice/bpservice.h"
+#include <stdio.h>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+
+// two independent 64 bit hashes of the input.  FNV-1a a byte at a time,
+// and a multiplicative hash of 8 byte words.
+static void
+hashBytes(const void* data, size_t len, boost::uint64_t& h1, boost::uint64_t& h2) {
+    const unsigned char* p = (const unsigned char*)data;
+    h1 = 14695981039346656037ULL;
+    h2 = (boost::uint64_t)len;
+    for (size_t i = 0; i < len; i++) {
+        h1 = (h1 ^ p[i]) * 1099511628211ULL;
+    }
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        boost::uint64_t w = 0;
+        for (unsigned int j = 0; j < 8; j++) {
+            w |= (boost::uint64_t)p[i + j] << (8 * j);
+        }
+        h2 = (h2 ^ w) * 0x9E3779B97F4A7C15ULL;
+        h2 ^= h2 >> 29;
+    }
+    for (; i < len; i++) {
+        h2 = (h2 ^ p[i]) * 0x9E3779B97F4A7C15ULL;
+        h2 ^= h2 >> 29;
+    }
+}
+
+// link from to to, copying if we can't
+static bool
+linkOrCopy(const fs::path& from, const fs::path& to) {
+    boost::system::error_code ec;
+    fs::create_hard_link(from, to, ec);
+    if (!ec) {
+        return true;
+    }
+    fs::copy_file(from, to, ec);
+    return !ec;
+}
+
+imageproc::OutputCache::OutputCache(const fs::path& dir, boost::uintmax_t budget)
+    : m_dir(dir), m_budget(budget), m_bytes(0), m_serial(0)
+{
+    boost::system::error_code ec;
+    fs::create_directories(m_dir, ec);
+}
+
+imageproc::OutputCache::~OutputCache() {
+    boost::system::error_code ec;
+    fs::remove_all(m_dir, ec);
+}
+
+std::string
+imageproc::OutputCache::key(const void* data, size_t len,
+                            const trans::ActionList& actions,
+                            const char* outputFormat, int quality,
+                            bool allFrames) {
+    boost::uint64_t h1;
+    boost::uint64_t h2;
+    hashBytes(data, len, h1, h2);
+    char hex[40];
+    (void)sprintf(hex, "%016llx%016llx", (unsigned long long)h1, (unsigned long long)h2);
+    std::stringstream ss;
+    ss << hex << "-" << len << "|" << (outputFormat ? outputFormat : "") << "|" << quality
+       << (allFrames ? "|frames" : "");
+    for (unsigned int i = 0; i < actions.size(); i++) {
+        ss << "|" << actions[i].transformation->name;
+        if (actions[i].args) {
+            ss << ":" << actions[i].args->toJsonString();
+        }
+    }
+    return ss.str();
+}
+
+bool
+imageproc::OutputCache::lookup(const std::string& key, const fs::path& dest, Result& result) {
+    boost::mutex::scoped_lock lock(m_lock);
+    std::map<std::string, Entry>::iterator it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        return false;
+    }
+    Entry& e = it->second;
+    if (!linkOrCopy(e.file, dest)) {
+        // someone removed it from under us
+        boost::system::error_code ec;
+        fs::remove(e.file, ec);
+        m_bytes -= e.bytes;
+        m_lru.erase(e.lru);
+        m_entries.erase(it);
+        return false;
+    }
+    m_lru.splice(m_lru.begin(), m_lru, e.lru);
+    result = e.result;
+    return true;
+}
+
+void
+imageproc::OutputCache::insert(const std::string& key, const fs::path& output, const Result& result) {
+    boost::system::error_code ec;
+    boost::uintmax_t bytes = fs::file_size(output, ec);
+    if (ec || bytes > m_budget) {
+        return;
+    }
+    boost::mutex::scoped_lock lock(m_lock);
+    if (m_entries.find(key) != m_entries.end()) {
+        return;
+    }
+    evict(m_budget - bytes);
+    // file names needn't mean anything, just be unique within m_dir
+    std::stringstream ss;
+    ss << "result-" << ++m_serial;
+    fs::path file = m_dir / ss.str();
+    if (!linkOrCopy(output, file)) {
+        return;
+    }
+    m_lru.push_front(key);
+    Entry& e = m_entries[key];
+    e.file = file;
+    e.bytes = bytes;
+    e.result = result;
+    e.lru = m_lru.begin();
+    m_bytes += bytes;
+    IA_LOG(BP_DEBUG, "cached result, " << m_entries.size() << " results totalling " << m_bytes << " bytes");
+}
+
+// drop least recently used entries until they total no more than budget
+void
+imageproc::OutputCache::evict(boost::uintmax_t budget) {
+    while (m_bytes > budget && !m_lru.empty()) {
+        std::map<std::string, Entry>::iterator it = m_entries.find(m_lru.back());
+        boost::system::error_code ec;
+        fs::remove(it->second.file, ec);
+        m_bytes -= it->second.bytes;
+        m_entries.erase(it);
+        m_lru.pop_back();
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A cache of transformation results, keyed by the contents of the
+ * input image and everything that determines the output: the
+ * (optimized) actions, the output format and the quality.
+ */
+
+#ifndef __OUTPUTCACHE_HH__
+#define __OUTPUTCACHE_HH__
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include "Actions.hh"
+
+namespace imageproc {
+    class OutputCache {
+    public:
+        /** what we remember about a result */
+        struct Result {
+            unsigned int x;
+            unsigned int y;
+            unsigned int orig_x;
+            unsigned int orig_y;
+        };
+        /** keep copies of results in dir (which is created, and removed
+         *  with its contents when the cache is destroyed), evicting the
+         *  least recently used once they total more than budget bytes */
+        OutputCache(const boost::filesystem::path& dir, boost::uintmax_t budget);
+        ~OutputCache();
+        /** the key for transforming the len bytes of data with actions,
+         *  outputFormat (NULL for the input format), quality and
+         *  allFrames (as for ChangeImage) */
+        static std::string key(const void* data, size_t len,
+                               const trans::ActionList& actions,
+                               const char* outputFormat, int quality,
+                               bool allFrames);
+        /** look up key.  On a hit the cached output is linked (or copied)
+         *  to dest and its dimensions returned in result. */
+        bool lookup(const std::string& key, const boost::filesystem::path& dest, Result& result);
+        /** remember that output, a file the caller keeps ownership of,
+         *  is the result for key */
+        void insert(const std::string& key, const boost::filesystem::path& output, const Result& result);
+    private:
+        struct Entry {
+            boost::filesystem::path file;
+            boost::uintmax_t bytes;
+            Result result;
+            // position in m_lru
+            std::list<std::string>::iterator lru;
+        };
+        void evict(boost::uintmax_t budget);
+        OutputCache(const OutputCache&);
+        OutputCache& operator=(const OutputCache&);
+
+        boost::filesystem::path m_dir;
+        boost::uintmax_t m_budget;
+        boost::uintmax_t m_bytes;
+        unsigned long m_serial;
+        boost::mutex m_lock;
+        std::map<std::string, Entry> m_entries;
+        // most recently used first
+        std::list<std::string> m_lru;
+    };
+};
+
+#endif
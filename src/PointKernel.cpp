@@ -0,0 +1,394 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PointKernel.hh"
+#include "BandScheduler.hh"
+#include "ColorMatrix.hh"
+#include "Luminance.hh"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// pixels per chunk in applyPixels, 16KB of 8 bit pixels
+#define POINTKERNEL_CHUNK 4096
+
+static Quantum
+negateCurve(Quantum v, double) {
+    return (Quantum)(MaxRGB - v);
+}
+
+static Quantum
+solarizeCurve(Quantum v, double threshold) {
+    return (Quantum)(v > threshold ? MaxRGB - v : v);
+}
+
+// the same brightness curve that GraphicsMagick's ContrastImage applies
+static void
+contrastPixel(const double sign, PixelPacket* p) {
+    double hue = 0.0;
+    double saturation = 0.0;
+    double brightness = 0.0;
+    TransformHSL(p->red, p->green, p->blue, &hue, &saturation, &brightness);
+    double theta = (brightness - 0.5) * MagickPI;
+    brightness += (((((sin(theta) + 1.0)) * 0.5) - brightness) * sign) * 0.5;
+    if (brightness > 1.0) {
+        brightness = 1.0;
+    } else if (brightness < 0.0) {
+        brightness = 0.0;
+    }
+    HSLTransform(hue, saturation, brightness, &p->red, &p->green, &p->blue);
+}
+
+trans::PointKernel::PointKernel() {
+}
+
+bool
+trans::PointKernel::empty() const {
+    return m_stages.empty();
+}
+
+unsigned int
+trans::PointKernel::size() const {
+    return m_ops.size();
+}
+
+trans::PointKernel::Stage&
+trans::PointKernel::addStage(StageType type) {
+    m_stages.push_back(Stage());
+    Stage& s = m_stages.back();
+    s.type = type;
+    s.param = 0.0;
+    s.count = 0;
+    memset(s.matrix, 0, sizeof(s.matrix));
+    return s;
+}
+
+trans::PointKernel::Op&
+trans::PointKernel::addOp(OpType type) {
+    m_ops.push_back(Op());
+    Op& op = m_ops.back();
+    op.type = type;
+    op.param = 0.0;
+    op.count = 0;
+    memset(op.matrix, 0, sizeof(op.matrix));
+    return op;
+}
+
+// add a transformation recorded by another kernel
+void
+trans::PointKernel::add(const Op& op) {
+    switch (op.type) {
+        case NegateOp: negate(); break;
+        case SolarizeOp: solarize(op.param); break;
+        case ContrastOp: contrast(op.param > 0.0, op.count); break;
+        case MatrixOp: colorMatrix(op.matrix); break;
+        case GrayscaleOp: grayscale((Luma)op.count); break;
+        case ThresholdOp: threshold(op.param); break;
+        case BlackThresholdOp: blackThreshold(op.param); break;
+    }
+}
+
+void
+trans::PointKernel::addCurve(Quantum (*curve)(Quantum, double), double param) {
+    if (!m_stages.empty() && m_stages.back().type == CurveStage) {
+        // compose with the preceding table, no new pass needed
+        std::vector<Quantum>& table = m_stages.back().table;
+        for (unsigned int v = 0; v <= MaxRGB; v++) {
+            table[v] = curve(table[v], param);
+        }
+        return;
+    }
+    Stage& s = addStage(CurveStage);
+    s.table.resize(MaxRGB + 1);
+    for (unsigned int v = 0; v <= MaxRGB; v++) {
+        s.table[v] = curve((Quantum)v, param);
+    }
+}
+
+void
+trans::PointKernel::negate() {
+    addOp(NegateOp);
+    addCurve(negateCurve, 0.0);
+}
+
+void
+trans::PointKernel::solarize(double threshold) {
+    addOp(SolarizeOp).param = threshold;
+    addCurve(solarizeCurve, threshold);
+}
+
+void
+trans::PointKernel::contrast(bool sharpen, unsigned int times) {
+    Op& op = addOp(ContrastOp);
+    op.param = sharpen ? 1.0 : -1.0;
+    op.count = times;
+    if (!m_stages.empty() && m_stages.back().type == ContrastStage &&
+        m_stages.back().param == (sharpen ? 1.0 : -1.0)) {
+        m_stages.back().count += times;
+        return;
+    }
+    Stage& s = addStage(ContrastStage);
+    s.param = sharpen ? 1.0 : -1.0;
+    s.count = times;
+}
+
+void
+trans::PointKernel::colorMatrix(const double matrix[3][3]) {
+    Op& op = addOp(MatrixOp);
+    memcpy(op.matrix, matrix, sizeof(op.matrix));
+    Stage& s = addStage(MatrixStage);
+    memcpy(s.matrix, matrix, sizeof(s.matrix));
+}
+
+void
+trans::PointKernel::grayscale(Luma luma) {
+    addOp(GrayscaleOp).count = luma;
+    Stage& s = addStage(GrayscaleStage);
+    s.count = luma;
+}
+
+void
+trans::PointKernel::threshold(double threshold) {
+    addOp(ThresholdOp).param = threshold;
+    Stage& s = addStage(ThresholdStage);
+    s.param = threshold;
+}
+
+void
+trans::PointKernel::blackThreshold(double threshold) {
+    addOp(BlackThresholdOp).param = threshold;
+    Stage& s = addStage(BlackThresholdStage);
+    s.param = threshold;
+}
+
+void
+trans::PointKernel::applyStage(const Stage& s, PixelPacket* p) {
+    switch (s.type) {
+        case CurveStage: {
+            const Quantum* table = &s.table[0];
+            p->red = table[p->red];
+            p->green = table[p->green];
+            p->blue = table[p->blue];
+            break;
+        }
+        case ContrastStage: {
+            for (unsigned int x = 0; x < s.count; x++) {
+                contrastPixel(s.param, p);
+            }
+            break;
+        }
+        case MatrixStage: {
+            colorMatrixScalar(s.matrix, p, 1);
+            break;
+        }
+        case GrayscaleStage: {
+            applyLuminance((Luma)s.count, p, 1);
+            break;
+        }
+        case ThresholdStage: {
+            Quantum q = (PixelIntensityToQuantum(p) <= s.param) ? 0 : MaxRGB;
+            p->red = p->green = p->blue = q;
+            break;
+        }
+        case BlackThresholdStage: {
+            if (PixelIntensityToQuantum(p) < s.param) {
+                p->red = p->green = p->blue = 0;
+            }
+            break;
+        }
+    }
+}
+
+void
+trans::PointKernel::applyPixel(PixelPacket* p) const {
+    for (unsigned int i = 0; i < m_stages.size(); i++) {
+        applyStage(m_stages[i], p);
+    }
+}
+
+void
+trans::PointKernel::applyPixels(PixelPacket* pixels, unsigned long n) const {
+    // run each stage over a cache sized chunk before moving to the next
+    // stage, which lets stages that have vectorized implementations
+    // process many pixels at once
+    for (unsigned long first = 0; first < n; first += POINTKERNEL_CHUNK) {
+        PixelPacket* p = pixels + first;
+        unsigned long count = n - first < POINTKERNEL_CHUNK ? n - first : POINTKERNEL_CHUNK;
+        for (unsigned int i = 0; i < m_stages.size(); i++) {
+            const Stage& s = m_stages[i];
+            if (s.type == MatrixStage) {
+                applyColorMatrix(s.matrix, p, count);
+                continue;
+            }
+            if (s.type == GrayscaleStage) {
+                applyLuminance((Luma)s.count, p, count);
+                continue;
+            }
+            for (unsigned long j = 0; j < count; j++) {
+                applyStage(s, p + j);
+            }
+        }
+    }
+}
+
+static void
+pointKernelWorker(const void* data, PixelPacket* pixels, IndexPacket* indexes,
+                  unsigned long columns, unsigned long firstRow, unsigned long rows) {
+    const trans::PointKernel* kernel = (const trans::PointKernel*)data;
+    kernel->applyPixels(pixels, columns * rows);
+}
+
+bool
+trans::PointKernel::apply(Image* image, std::string& oError) const {
+    if (m_stages.empty()) {
+        return true;
+    }
+    if (image->colorspace == CMYKColorspace) {
+        return applyMagick(image, oError);
+    }
+    return applyStages(image, oError);
+}
+
+// the transformations one at a time, as GraphicsMagick does them to a
+// CMYK image.  sepia's matrix works on the channels whatever they are,
+// as it always did.  grayscale converts to RGB first, and as the image
+// is no longer CMYK after that the rest can run as stages again.
+bool
+trans::PointKernel::applyMagick(Image* image, std::string& oError) const {
+    for (unsigned int i = 0; i < m_ops.size(); i++) {
+        const Op& op = m_ops[i];
+        bool ok = true;
+        switch (op.type) {
+            case NegateOp:
+                ok = NegateImage(image, 0);
+                break;
+            case SolarizeOp:
+                ok = SolarizeImage(image, op.param);
+                break;
+            case ContrastOp:
+                for (unsigned int x = 0; ok && x < op.count; x++) {
+                    ok = ContrastImage(image, op.param > 0.0);
+                }
+                break;
+            case MatrixOp: {
+                PointKernel k;
+                k.colorMatrix(op.matrix);
+                if (!k.applyStages(image, oError)) {
+                    return false;
+                }
+                break;
+            }
+            case GrayscaleOp: {
+                if (!TransformColorspace(image, RGBColorspace)) {
+                    oError.append("couldn't convert image to RGB");
+                    return false;
+                }
+                PointKernel rest;
+                for (unsigned int j = i; j < m_ops.size(); j++) {
+                    rest.add(m_ops[j]);
+                }
+                return rest.applyStages(image, oError);
+            }
+            case ThresholdOp:
+                ok = ThresholdImage(image, op.param);
+                break;
+            case BlackThresholdOp: {
+                char threshold[32];
+                sprintf(threshold, "%g", op.param);
+                ok = BlackThresholdImage(image, threshold);
+                break;
+            }
+        }
+        if (!ok) {
+            oError.append("error during pixel operations occured");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+trans::PointKernel::applyStages(Image* image, std::string& oError) const {
+    // work out what we'll know about the image when we're done, encoders
+    // use these hints to pick the output color type
+    bool gray = image->is_grayscale ? true : false;
+    bool mono = image->is_monochrome ? true : false;
+    // like GraphicsMagick's own conversion to gray, grayscale leaves the
+    // image in the gray colorspace so encoders write a single channel
+    bool grayColorspace = (image->colorspace == GRAYColorspace);
+    for (unsigned int i = 0; i < m_stages.size(); i++) {
+        const Stage& s = m_stages[i];
+        switch (s.type) {
+            case CurveStage:
+                mono = mono && (s.table[0] == 0 || s.table[0] == MaxRGB) &&
+                    (s.table[MaxRGB] == 0 || s.table[MaxRGB] == MaxRGB);
+                break;
+            case MatrixStage:
+                gray = false;
+                mono = false;
+                grayColorspace = false;
+                break;
+            case GrayscaleStage:
+                gray = true;
+                grayColorspace = true;
+                break;
+            case ThresholdStage:
+                gray = true;
+                mono = true;
+                break;
+            default:
+                break;
+        }
+    }
+    if (image->storage_class == PseudoClass) {
+        // palette images only need their colormap transformed
+        for (unsigned int i = 0; i < image->colors; i++) {
+            applyPixel(image->colormap + i);
+        }
+        if (!SyncImage(image)) {
+            oError.append("error during pixel operations occured");
+            return false;
+        }
+    } else {
+        // every pixel is independent, so large images are split
+        // across cores
+        if (!imageproc::ModifyPixelsInBands(image, pointKernelWorker, this, oError)) {
+            return false;
+        }
+    }
+    image->is_grayscale = gray;
+    image->is_monochrome = mono;
+    if (image->colorspace == RGBColorspace || image->colorspace == GRAYColorspace) {
+        image->colorspace = grayColorspace ? GRAYColorspace : RGBColorspace;
+    }
+    return true;
+}
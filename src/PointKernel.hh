@@ -0,0 +1,135 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A PointKernel is a compiled run of pixel-local transformations
+ * (negate, solarize, contrast, sepia, ...).  Every stage is a function
+ * of a single pixel's color, so any number of them can be applied to
+ * an image in one pass over its pixels.
+ *
+ * CMYK images are the exception: their channels aren't red, green and
+ * blue, so each transformation is left to GraphicsMagick, one at a
+ * time, as it was before they were fused.
+ */
+
+#ifndef __POINTKERNEL_HH__
+#define __POINTKERNEL_HH__
+
+#include <string>
+#include <vector>
+#include <magick/api.h>
+#include "Luminance.hh"
+
+#if QuantumDepth > 16
+#error "PointKernel lookup tables require a QuantumDepth of 16 or less"
+#endif
+
+namespace trans {
+    class PointKernel {
+    public:
+        PointKernel();
+        /** true if no stages have been added */
+        bool empty() const;
+        /** the number of transformations compiled into this kernel */
+        unsigned int size() const;
+        /** invert red, green and blue */
+        void negate();
+        /** invert channel values above threshold */
+        void solarize(double threshold);
+        /** adjust brightness in HSL space, times times */
+        void contrast(bool sharpen, unsigned int times);
+        /** replace each pixel with matrix * (r, g, b), saturating at MaxRGB */
+        void colorMatrix(const double matrix[3][3]);
+        /** replace each pixel with its intensity, weighted by luma */
+        void grayscale(Luma luma = Rec601Luma);
+        /** pixels with an intensity at or under threshold become black, all
+         *  others white */
+        void threshold(double threshold);
+        /** pixels with an intensity under threshold become black */
+        void blackThreshold(double threshold);
+        /** run all stages over image in a single pass, or for a CMYK
+         *  image each transformation in turn.  returns false and
+         *  populates oError on failure */
+        bool apply(Image* image, std::string& oError) const;
+        /** run all stages over a single pixel */
+        void applyPixel(PixelPacket* pixel) const;
+        /** run all stages over n consecutive pixels, the same as calling
+         *  applyPixel() on each */
+        void applyPixels(PixelPacket* pixels, unsigned long n) const;
+    private:
+        enum StageType {
+            // a per channel lookup table, consecutive curves are
+            // composed into a single table at compile time
+            CurveStage,
+            ContrastStage,
+            MatrixStage,
+            GrayscaleStage,
+            ThresholdStage,
+            BlackThresholdStage
+        };
+        struct Stage {
+            StageType type;
+            double param;
+            unsigned int count;
+            double matrix[3][3];
+            std::vector<Quantum> table;
+        };
+        // each transformation as it was added, before stages were
+        // composed, for images the stages can't run on
+        enum OpType {
+            NegateOp,
+            SolarizeOp,
+            ContrastOp,
+            MatrixOp,
+            GrayscaleOp,
+            ThresholdOp,
+            BlackThresholdOp
+        };
+        struct Op {
+            OpType type;
+            double param;
+            unsigned int count;
+            double matrix[3][3];
+        };
+        Stage& addStage(StageType type);
+        static void applyStage(const Stage& s, PixelPacket* p);
+        void addCurve(Quantum (*curve)(Quantum, double), double param);
+        Op& addOp(OpType type);
+        void add(const Op& op);
+        bool applyStages(Image* image, std::string& oError) const;
+        bool applyMagick(Image* image, std::string& oError) const;
+        std::vector<Stage> m_stages;
+        std::vector<Op> m_ops;
+    };
+};
+
+#endif
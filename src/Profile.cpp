@@ -0,0 +1,92 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Profile.hh"
+#ifdef WIN32
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+double
+imageproc::monotonicMillis() {
+#ifdef WIN32
+    LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t s_timebase;
+    if (s_timebase.denom == 0) {
+        mach_timebase_info(&s_timebase);
+    }
+    return (double)mach_absolute_time() * s_timebase.numer / s_timebase.denom / 1000000.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
+
+imageproc::Profile::Profile()
+    : bytesIn(0), bytesOut(0), peakPixelBytes(0), m_start(0.0)
+{
+}
+
+void
+imageproc::Profile::begin(const std::string& name) {
+    end();
+    m_stage = name;
+    m_start = monotonicMillis();
+}
+
+void
+imageproc::Profile::end() {
+    if (m_stage.empty()) {
+        return;
+    }
+    Stage s;
+    s.name = m_stage;
+    s.millis = monotonicMillis() - m_start;
+    stages.push_back(s);
+    m_stage.clear();
+}
+
+void
+imageproc::Profile::pixels(boost::uintmax_t bytes) {
+    if (bytes > peakPixelBytes) {
+        peakPixelBytes = bytes;
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Where the time and memory of a transform go: each stage timed with a
+ * monotonic clock, plus bytes in and out and the most pixel memory
+ * held at once.
+ */
+
+#ifndef __PROFILE_HH__
+#define __PROFILE_HH__
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace imageproc {
+    /** milliseconds since some arbitrary point, never going backwards */
+    double monotonicMillis();
+
+    class Profile {
+    public:
+        struct Stage {
+            std::string name;
+            double millis;
+        };
+        Profile();
+        /** start timing a stage, ending the running one if any */
+        void begin(const std::string& name);
+        /** end the running stage */
+        void end();
+        /** note that bytes of pixels are held at once */
+        void pixels(boost::uintmax_t bytes);
+
+        // completed stages, in order
+        std::vector<Stage> stages;
+        // size of the encoded input and output
+        boost::uintmax_t bytesIn;
+        boost::uintmax_t bytesOut;
+        // the most pixel memory held at once
+        boost::uintmax_t peakPixelBytes;
+    private:
+        std::string m_stage;
+        double m_start;
+    };
+};
+
+#endif
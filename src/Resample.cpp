@@ -0,0 +1,452 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The two pass separable resampler, see Resample.hh.
+ */
+
+#include "Resample.hh"
+#include "BandScheduler.hh"
+#include "ColorMatrix.hh"
+#include <list>
+#include <map>
+#include <string>
+#include <boost/thread/mutex.hpp>
+#include <math.h>
+
+#if defined(IA_X86_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define IA_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// how many weight tables are kept for reuse.  Services tend to make the
+// same few sizes over and over.
+#define RESAMPLE_CACHED_TABLES 64
+
+#define RESAMPLE_ONE (1 << RESAMPLE_BITS)
+#define RESAMPLE_HALF (1 << (RESAMPLE_BITS - 1))
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static bool s_native = false;
+
+void
+trans::useNativeResampler(bool on) {
+    s_native = on;
+}
+
+bool
+trans::nativeResampler() {
+    return s_native;
+}
+
+static double
+sinc(double x) {
+    if (x == 0.0) {
+        return 1.0;
+    }
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+// the filter's support (radius) and value at x, in target pixels
+static double
+filterSupport(trans::ResampleFilter filter) {
+    return filter == trans::LanczosResample ? 3.0 : 1.0;
+}
+
+static double
+filterWeight(trans::ResampleFilter filter, double x) {
+    x = fabs(x);
+    if (filter == trans::LanczosResample) {
+        return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    }
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+static boost::shared_ptr<const trans::ResampleWeights>
+computeWeights(unsigned long src, unsigned long dst, trans::ResampleFilter filter) {
+    trans::ResampleWeights* w = new trans::ResampleWeights;
+    boost::shared_ptr<const trans::ResampleWeights> rval(w);
+    // when shrinking the filter is stretched to cover all the source
+    // pixels that fall in a target pixel
+    double scale = (double)dst / (double)src;
+    double factor = scale < 1.0 ? scale : 1.0;
+    double support = filterSupport(filter) / factor;
+    // every target pixel draws on the same number of source pixels,
+    // which keeps the inner loops simple
+    w->taps = (unsigned int)ceil(support * 2.0) + 1;
+    if (w->taps > src) {
+        w->taps = (unsigned int)src;
+    }
+    w->first.resize(dst);
+    w->weights.resize(dst * w->taps, 0);
+    std::vector<double> contrib(w->taps);
+    for (unsigned long i = 0; i < dst; i++) {
+        double center = ((double)i + 0.5) / scale;
+        long left = (long)floor(center - support);
+        long right = (long)ceil(center + support);
+        long first = left < 0 ? 0 : left;
+        if (first + (long)w->taps > (long)src) {
+            first = (long)src - (long)w->taps;
+        }
+        w->first[i] = first;
+        std::fill(contrib.begin(), contrib.end(), 0.0);
+        double total = 0.0;
+        for (long j = left; j <= right; j++) {
+            double v = filterWeight(filter, ((double)j + 0.5 - center) * factor);
+            if (v == 0.0) {
+                continue;
+            }
+            // pixels past the edges are left out, and the weights of
+            // the rest scaled up to make up for them, as ResizeImage()
+            // does.  Repeating the edge pixel instead would weigh it
+            // far too heavily in a large reduction.
+            if (j < first || j >= first + (long)w->taps || j >= (long)src) {
+                continue;
+            }
+            contrib[j - first] += v;
+            total += v;
+        }
+        if (total == 0.0) {
+            // nothing in reach, take the nearest pixel
+            long k = (long)center;
+            if (k >= (long)src) {
+                k = (long)src - 1;
+            }
+            contrib[k - first] = 1.0;
+            total = 1.0;
+        }
+        // to fixed point, the rounding error going to the largest weight
+        // so that they sum to exactly one
+        short* out = &w->weights[i * w->taps];
+        long sum = 0;
+        unsigned int largest = 0;
+        for (unsigned int t = 0; t < w->taps; t++) {
+            out[t] = (short)floor(contrib[t] / total * RESAMPLE_ONE + 0.5);
+            sum += out[t];
+            if (out[t] > out[largest]) {
+                largest = t;
+            }
+        }
+        out[largest] = (short)(out[largest] + (RESAMPLE_ONE - sum));
+    }
+    unsigned int perPixel = (w->taps + 1) / 2;
+    w->pairs.resize(dst * perPixel);
+    for (unsigned long i = 0; i < dst; i++) {
+        const short* in = &w->weights[i * w->taps];
+        for (unsigned int t = 0; t < w->taps; t += 2) {
+            unsigned short lo = (unsigned short)in[t];
+            unsigned short hi = t + 1 < w->taps ? (unsigned short)in[t + 1] : 0;
+            w->pairs[i * perPixel + t / 2] = (int)(((unsigned int)hi << 16) | lo);
+        }
+    }
+    return rval;
+}
+
+namespace {
+    struct WeightsKey {
+        unsigned long src;
+        unsigned long dst;
+        trans::ResampleFilter filter;
+        bool operator<(const WeightsKey& o) const {
+            if (src != o.src) {
+                return src < o.src;
+            }
+            if (dst != o.dst) {
+                return dst < o.dst;
+            }
+            return filter < o.filter;
+        }
+    };
+    struct CachedWeights {
+        boost::shared_ptr<const trans::ResampleWeights> weights;
+        std::list<WeightsKey>::iterator lru;
+    };
+}
+
+static boost::mutex s_weightsLock;
+static std::map<WeightsKey, CachedWeights> s_weights;
+// most recently used first
+static std::list<WeightsKey> s_weightsLRU;
+
+boost::shared_ptr<const trans::ResampleWeights>
+trans::resampleWeights(unsigned long src, unsigned long dst, ResampleFilter filter) {
+    WeightsKey key;
+    key.src = src;
+    key.dst = dst;
+    key.filter = filter;
+    {
+        boost::mutex::scoped_lock lock(s_weightsLock);
+        std::map<WeightsKey, CachedWeights>::iterator it = s_weights.find(key);
+        if (it != s_weights.end()) {
+            s_weightsLRU.splice(s_weightsLRU.begin(), s_weightsLRU, it->second.lru);
+            return it->second.weights;
+        }
+    }
+    // computed without the lock, should two threads race to make the
+    // same table the second simply replaces the first
+    boost::shared_ptr<const ResampleWeights> w = computeWeights(src, dst, filter);
+    boost::mutex::scoped_lock lock(s_weightsLock);
+    std::map<WeightsKey, CachedWeights>::iterator it = s_weights.find(key);
+    if (it != s_weights.end()) {
+        s_weightsLRU.erase(it->second.lru);
+        s_weights.erase(it);
+    }
+    s_weightsLRU.push_front(key);
+    CachedWeights& c = s_weights[key];
+    c.weights = w;
+    c.lru = s_weightsLRU.begin();
+    while (s_weights.size() > RESAMPLE_CACHED_TABLES) {
+        s_weights.erase(s_weightsLRU.back());
+        s_weightsLRU.pop_back();
+    }
+    return w;
+}
+
+// a fixed point sum back to a Quantum, rounded and clamped
+static inline Quantum
+toQuantum(long long v) {
+    if (v <= 0) {
+        return 0;
+    }
+    v = (v + RESAMPLE_HALF) >> RESAMPLE_BITS;
+    return v > MaxRGB ? (Quantum)MaxRGB : (Quantum)v;
+}
+
+void
+trans::resampleRowScalar(const ResampleWeights& weights, const PixelPacket* src,
+                         PixelPacket* dst, unsigned long columns) {
+    const unsigned int taps = weights.taps;
+    for (unsigned long x = 0; x < columns; x++) {
+        const PixelPacket* p = src + weights.first[x];
+        const short* w = &weights.weights[x * taps];
+        long long r = 0;
+        long long g = 0;
+        long long b = 0;
+        long long o = 0;
+        for (unsigned int t = 0; t < taps; t++) {
+            r += (long long)w[t] * p[t].red;
+            g += (long long)w[t] * p[t].green;
+            b += (long long)w[t] * p[t].blue;
+            o += (long long)w[t] * p[t].opacity;
+        }
+        dst[x].red = toQuantum(r);
+        dst[x].green = toQuantum(g);
+        dst[x].blue = toQuantum(b);
+        dst[x].opacity = toQuantum(o);
+    }
+}
+
+void
+trans::resampleColumnScalar(const ResampleWeights& weights, unsigned long y,
+                            const PixelPacket* const* rows, PixelPacket* dst,
+                            unsigned long first, unsigned long columns) {
+    const unsigned int taps = weights.taps;
+    const short* w = &weights.weights[y * taps];
+    for (unsigned long x = first; x < columns; x++) {
+        long long r = 0;
+        long long g = 0;
+        long long b = 0;
+        long long o = 0;
+        for (unsigned int t = 0; t < taps; t++) {
+            const PixelPacket& p = rows[t][x];
+            r += (long long)w[t] * p.red;
+            g += (long long)w[t] * p.green;
+            b += (long long)w[t] * p.blue;
+            o += (long long)w[t] * p.opacity;
+        }
+        dst[x].red = toQuantum(r);
+        dst[x].green = toQuantum(g);
+        dst[x].blue = toQuantum(b);
+        dst[x].opacity = toQuantum(o);
+    }
+}
+
+static trans::KernelRegistrar<trans::ResampleRowKernel>
+s_rowScalar("scalar", 0, NULL, trans::resampleRowScalar);
+static trans::KernelRegistrar<trans::ResampleColumnKernel>
+s_columnScalar("scalar", 0, NULL, trans::resampleColumnScalar);
+
+#ifdef IA_HAVE_SSE2
+// four 32 bit sums rounded back to Quantum scale.  Packing the result
+// down to bytes then saturates them as toQuantum() clamps.
+static inline __m128i
+roundSums(__m128i v) {
+    return _mm_srai_epi32(_mm_add_epi32(v, _mm_set1_epi32(RESAMPLE_HALF)), RESAMPLE_BITS);
+}
+
+// a pixel is a 32 bit lane of four 8 bit channels.  Each pair of taps
+// interleaves the channels of two source pixels as 16 bit values, so a
+// single multiply-add applies both weights to all four channels.
+static void
+resampleRowSSE2(const trans::ResampleWeights& weights, const PixelPacket* src,
+                PixelPacket* dst, unsigned long columns) {
+    const unsigned int taps = weights.taps;
+    const unsigned int perPixel = (taps + 1) / 2;
+    const __m128i zero = _mm_setzero_si128();
+    for (unsigned long x = 0; x < columns; x++) {
+        const PixelPacket* p = src + weights.first[x];
+        const int* w = &weights.pairs[x * perPixel];
+        __m128i acc = zero;
+        unsigned int t = 0;
+        for (; t + 2 <= taps; t += 2) {
+            __m128i ab = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + t)), zero);
+            ab = _mm_unpacklo_epi16(ab, _mm_srli_si128(ab, 8));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(ab, _mm_set1_epi32(w[t / 2])));
+        }
+        if (t < taps) {
+            // the odd one out, its weight is paired with 0
+            __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int*)(p + t)), zero);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), _mm_set1_epi32(w[t / 2])));
+        }
+        __m128i v = roundSums(acc);
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), zero);
+        *(int*)(dst + x) = _mm_cvtsi128_si32(v);
+    }
+}
+
+// four pixels at a time.  Each pair of taps interleaves the channels of
+// a pixel in two rows, as for the rows.
+static void
+resampleColumnSSE2(const trans::ResampleWeights& weights, unsigned long y,
+                   const PixelPacket* const* rows, PixelPacket* dst,
+                   unsigned long first, unsigned long columns) {
+    const unsigned int taps = weights.taps;
+    const int* w = &weights.pairs[y * ((taps + 1) / 2)];
+    const __m128i zero = _mm_setzero_si128();
+    unsigned long x = first;
+    for (; x + 4 <= columns; x += 4) {
+        __m128i acc0 = zero;
+        __m128i acc1 = zero;
+        __m128i acc2 = zero;
+        __m128i acc3 = zero;
+        for (unsigned int t = 0; t < taps; t += 2) {
+            // an odd last row pairs with itself, at no weight
+            unsigned int u = t + 1 < taps ? t + 1 : t;
+            __m128i wt = _mm_set1_epi32(w[t / 2]);
+            __m128i a = _mm_loadu_si128((const __m128i*)(rows[t] + x));
+            __m128i b = _mm_loadu_si128((const __m128i*)(rows[u] + x));
+            __m128i alo = _mm_unpacklo_epi8(a, zero);
+            __m128i blo = _mm_unpacklo_epi8(b, zero);
+            __m128i ahi = _mm_unpackhi_epi8(a, zero);
+            __m128i bhi = _mm_unpackhi_epi8(b, zero);
+            acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(alo, blo), wt));
+            acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(alo, blo), wt));
+            acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi16(ahi, bhi), wt));
+            acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi16(ahi, bhi), wt));
+        }
+        __m128i lo = _mm_packs_epi32(roundSums(acc0), roundSums(acc1));
+        __m128i hi = _mm_packs_epi32(roundSums(acc2), roundSums(acc3));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    trans::resampleColumnScalar(weights, y, rows, dst, x, columns);
+}
+
+static trans::KernelRegistrar<trans::ResampleRowKernel>
+s_rowSSE2("sse2", 10, trans::cpuHasSSE2, resampleRowSSE2);
+static trans::KernelRegistrar<trans::ResampleColumnKernel>
+s_columnSSE2("sse2", 10, trans::cpuHasSSE2, resampleColumnSSE2);
+#endif
+
+namespace {
+    struct ResampleJob {
+        const PixelPacket* src;
+        unsigned long srcColumns;
+        boost::shared_ptr<const trans::ResampleWeights> across;
+        boost::shared_ptr<const trans::ResampleWeights> down;
+        trans::ResampleRowKernel::Func row;
+        trans::ResampleColumnKernel::Func column;
+    };
+}
+
+// make a band of target rows: the source rows they draw on are resampled
+// across into a strip small enough to stay in cache, then the strip is
+// resampled down
+static void
+resampleBand(const void* data, PixelPacket* pixels, IndexPacket* indexes,
+             unsigned long columns, unsigned long firstRow, unsigned long rows) {
+    const ResampleJob* job = (const ResampleJob*)data;
+    const trans::ResampleWeights& down = *job->down;
+    const long top = down.first[firstRow];
+    const long bottom = down.first[firstRow + rows - 1] + (long)down.taps;
+    std::vector<PixelPacket> strip((bottom - top) * columns);
+    for (long y = top; y < bottom; y++) {
+        job->row(*job->across, job->src + y * job->srcColumns, &strip[(y - top) * columns], columns);
+    }
+    std::vector<const PixelPacket*> taps(down.taps);
+    for (unsigned long y = 0; y < rows; y++) {
+        long first = down.first[firstRow + y];
+        for (unsigned int t = 0; t < down.taps; t++) {
+            taps[t] = &strip[(first - top + t) * columns];
+        }
+        job->column(down, firstRow + y, &taps[0], pixels + y * columns, 0, columns);
+    }
+}
+
+Image*
+trans::resampleImage(const Image* image, unsigned long columns, unsigned long rows,
+                     ResampleFilter filter, ExceptionInfo* exception) {
+    if (columns == image->columns && rows == image->rows) {
+        // as ResizeImage() does, so resizing to the same size is a copy
+        return CloneImage(image, 0, 0, 1, exception);
+    }
+    const PixelPacket* src = NULL;
+    if (image->colorspace != CMYKColorspace && columns > 0 && rows > 0) {
+        src = AcquireImagePixels(image, 0, 0, image->columns, image->rows, exception);
+    }
+    if (src == NULL) {
+        return ResizeImage(image, columns, rows,
+                           filter == LanczosResample ? LanczosFilter : TriangleFilter, 1.0, exception);
+    }
+    Image* resized = CloneImage(image, columns, rows, 1, exception);
+    if (resized == NULL) {
+        return NULL;
+    }
+    resized->storage_class = DirectClass;
+    resized->is_monochrome = 0;
+    ResampleJob job;
+    job.src = src;
+    job.srcColumns = image->columns;
+    job.across = resampleWeights(image->columns, columns, filter);
+    job.down = resampleWeights(image->rows, rows, filter);
+    job.row = KernelRegistry<ResampleRowKernel>::instance().best().func;
+    job.column = KernelRegistry<ResampleColumnKernel>::instance().best().func;
+    std::string err;
+    if (!imageproc::ModifyPixelsInBands(resized, resampleBand, &job, err)) {
+        DestroyImage(resized);
+        return NULL;
+    }
+    return resized;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A two pass separable resampler: each row is resampled horizontally,
+ * then each column vertically, with weights computed once per (source
+ * size, target size, filter) and kept for reuse.  Arithmetic is 14 bit
+ * fixed point, and the intermediate is rounded to a Quantum, so every
+ * implementation of the two passes computes exactly the same pixels.
+ *
+ * The output is close to, but not the same as, GraphicsMagick's
+ * ResizeImage(): with the same filter no sample differs by more than a
+ * level or two, from rounding the weights and the intermediate.  So
+ * it's only used when turned on.
+ */
+
+#ifndef __RESAMPLE_HH__
+#define __RESAMPLE_HH__
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <magick/api.h>
+#include "SIMD.hh"
+
+// weights are fixed point with this many fractional bits
+#define RESAMPLE_BITS 14
+
+namespace trans {
+    /** the filters we resample with */
+    enum ResampleFilter {
+        // windowed sinc with 3 lobes, as scale uses
+        LanczosResample,
+        // linear interpolation, cheaper but softer
+        TriangleResample
+    };
+    /** how the source pixels along one axis contribute to each target
+     *  pixel.  Every target pixel draws on taps consecutive source
+     *  pixels, starting at first[i], with weights[i * taps ...] that
+     *  sum to 1 << RESAMPLE_BITS.  Source pixels beyond the edges
+     *  don't contribute, the weights of the rest are scaled up instead. */
+    struct ResampleWeights {
+        unsigned int taps;
+        std::vector<long> first;
+        std::vector<short> weights;
+        // the weights of each target pixel two at a time, the first in
+        // the low half, as SIMD kernels multiply them.  An odd last
+        // weight is paired with 0.  (taps + 1) / 2 per target pixel.
+        std::vector<int> pairs;
+    };
+    /** the weights for resampling src pixels to dst pixels with filter.
+     *  The most recently used tables are kept, so repeated requests for
+     *  the same sizes don't recompute them. */
+    boost::shared_ptr<const ResampleWeights> resampleWeights(unsigned long src, unsigned long dst,
+                                                             ResampleFilter filter);
+    /** tag for the horizontal pass's registry: resample the row at src
+     *  into the columns pixels at dst */
+    struct ResampleRowKernel {
+        typedef void (*Func)(const ResampleWeights& weights, const PixelPacket* src,
+                             PixelPacket* dst, unsigned long columns);
+    };
+    /** tag for the vertical pass's registry: make target row y, given
+     *  the source rows it draws on.  dst[x] for x from first to columns
+     *  is the weighted sum of rows[t][x] over the taps rows. */
+    struct ResampleColumnKernel {
+        typedef void (*Func)(const ResampleWeights& weights, unsigned long y,
+                             const PixelPacket* const* rows, PixelPacket* dst,
+                             unsigned long first, unsigned long columns);
+    };
+    /** the portable implementations, SIMD variants use them for pixels
+     *  left over after their last full vector */
+    void resampleRowScalar(const ResampleWeights& weights, const PixelPacket* src,
+                           PixelPacket* dst, unsigned long columns);
+    void resampleColumnScalar(const ResampleWeights& weights, unsigned long y,
+                              const PixelPacket* const* rows, PixelPacket* dst,
+                              unsigned long first, unsigned long columns);
+    /** resize the first frame of image to columns by rows with filter.
+     *  Images we can't resample ourselves (CMYK, or those whose pixels
+     *  aren't in memory) go to ResizeImage() with the equivalent filter.
+     *  \returns a new single frame image, or NULL on failure */
+    Image* resampleImage(const Image* image, unsigned long columns, unsigned long rows,
+                         ResampleFilter filter, ExceptionInfo* exception);
+    /** resize with resampleImage() rather than GraphicsMagick in the
+     *  scale and thumbnail actions.  Off by default, as the results
+     *  differ slightly.  Not to be changed while images are being
+     *  transformed. */
+    void useNativeResampler(bool on);
+    bool nativeResampler();
+};
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks of the native resampler (Resample.hh) that the service's tests
+ * can't make, as scale and thumbnail never enlarge and the weight tables
+ * aren't visible from outside: the tables are reused, and dropped and
+ * made again the same; every table's weights sum to one; and resized
+ * images, odd sizes, single pixel rows and columns and a 3x enlargement
+ * among them, are within two levels of a floating point resize and exactly
+ * what the portable code makes.  Prints what failed and exits non-zero
+ * if anything did.
+ *
+ * usage: ResampleTest
+ */
+
+#include "Resample.hh"
+#include <magick/api.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+
+// a resized sample may differ from the floating point one by this much,
+// the rounding of both passes adding up
+#define RT_TOLERANCE 2
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static unsigned int s_failures = 0;
+
+static void
+check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cout << "FAILED: " << what << std::endl;
+        s_failures++;
+    }
+}
+
+static std::string
+sizeName(unsigned long columns, unsigned long rows) {
+    std::stringstream ss;
+    ss << columns << "x" << rows;
+    return ss.str();
+}
+
+// the filters, written out again rather than shared with Resample.cpp
+static double
+referenceWeight(trans::ResampleFilter filter, double x) {
+    x = fabs(x);
+    if (filter == trans::TriangleResample) {
+        return x < 1.0 ? 1.0 - x : 0.0;
+    }
+    if (x >= 3.0) {
+        return 0.0;
+    }
+    if (x == 0.0) {
+        return 1.0;
+    }
+    return 3.0 * sin(M_PI * x) * sin(M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+}
+
+// resample count values at stride apart from src to dst in floating
+// point, leaving out what lies beyond the edges, then round them back to
+// Quantum as the resampler does between its passes
+static void
+referenceResample(const std::vector<double>& in, unsigned long src, unsigned long dst,
+                  unsigned long count, trans::ResampleFilter filter, std::vector<double>& out) {
+    double scale = (double)dst / (double)src;
+    double factor = scale < 1.0 ? scale : 1.0;
+    double support = (filter == trans::LanczosResample ? 3.0 : 1.0) / factor;
+    out.assign(dst * count, 0.0);
+    for (unsigned long i = 0; i < dst; i++) {
+        double center = ((double)i + 0.5) / scale;
+        std::vector<double> sums(count, 0.0);
+        double total = 0.0;
+        for (unsigned long j = 0; j < src; j++) {
+            double w = referenceWeight(filter, ((double)j + 0.5 - center) * factor);
+            if (w == 0.0 || fabs((double)j + 0.5 - center) >= support) {
+                continue;
+            }
+            total += w;
+            for (unsigned long c = 0; c < count; c++) {
+                sums[c] += w * in[j * count + c];
+            }
+        }
+        for (unsigned long c = 0; c < count; c++) {
+            double v = floor(sums[c] / total + 0.5);
+            out[i * count + c] = v < 0.0 ? 0.0 : (v > MaxRGBDouble ? MaxRGBDouble : v);
+        }
+    }
+}
+
+static void
+checkTables() {
+    // a repeated request is answered from the cache
+    boost::shared_ptr<const trans::ResampleWeights> a =
+        trans::resampleWeights(997, 333, trans::LanczosResample);
+    check(trans::resampleWeights(997, 333, trans::LanczosResample) == a,
+          "a repeated request reuses its weight table");
+    check(trans::resampleWeights(997, 333, trans::TriangleResample) != a,
+          "each filter has its own weight tables");
+    // far more tables than are kept push it out, and it's made again the
+    // same
+    for (unsigned long i = 0; i < 1000; i++) {
+        trans::resampleWeights(2000 + i, 100, trans::LanczosResample);
+    }
+    boost::shared_ptr<const trans::ResampleWeights> b =
+        trans::resampleWeights(997, 333, trans::LanczosResample);
+    check(b != a, "the least recently used weight tables are dropped");
+    check(b->taps == a->taps && b->first == a->first && b->weights == a->weights &&
+          b->pairs == a->pairs, "a dropped weight table is made again the same");
+
+    unsigned long sizes[][2] = {
+        {997, 333}, {333, 997}, {1, 1}, {1, 7}, {7, 1}, {525, 1}, {5, 15}, {2, 3}, {61, 20}
+    };
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (int f = 0; f < 2; f++) {
+            trans::ResampleFilter filter = f ? trans::TriangleResample : trans::LanczosResample;
+            unsigned long src = sizes[s][0];
+            unsigned long dst = sizes[s][1];
+            boost::shared_ptr<const trans::ResampleWeights> w = trans::resampleWeights(src, dst, filter);
+            std::string name = (f ? "triangle " : "lanczos ") + sizeName(src, dst);
+            check(w->taps >= 1 && w->taps <= src, name + ": taps within the source");
+            bool inside = true;
+            bool one = true;
+            for (unsigned long i = 0; i < dst; i++) {
+                inside = inside && w->first[i] >= 0 && w->first[i] + (long)w->taps <= (long)src;
+                long sum = 0;
+                for (unsigned int t = 0; t < w->taps; t++) {
+                    sum += w->weights[i * w->taps + t];
+                }
+                one = one && sum == (1 << RESAMPLE_BITS);
+            }
+            check(inside, name + ": every tap within the source");
+            check(one, name + ": weights sum to one");
+        }
+    }
+}
+
+static void
+checkResize(const Image* image, unsigned long columns, unsigned long rows,
+            trans::ResampleFilter filter) {
+    std::string name = std::string(filter == trans::TriangleResample ? "triangle " : "lanczos ") +
+        sizeName(image->columns, image->rows) + " to " + sizeName(columns, rows);
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    Image* resized = trans::resampleImage(image, columns, rows, filter, &exception);
+    DestroyExceptionInfo(&exception);
+    check(resized != NULL && resized->columns == columns && resized->rows == rows,
+          name + ": resized to the size asked for");
+    if (resized == NULL) {
+        return;
+    }
+    GetExceptionInfo(&exception);
+    const PixelPacket* src = AcquireImagePixels(image, 0, 0, image->columns, image->rows, &exception);
+    const PixelPacket* got = AcquireImagePixels(resized, 0, 0, columns, rows, &exception);
+    DestroyExceptionInfo(&exception);
+
+    // across then down in floating point
+    std::vector<double> in(image->columns * image->rows * 4);
+    for (unsigned long i = 0; i < image->columns * image->rows; i++) {
+        in[i * 4] = src[i].red;
+        in[i * 4 + 1] = src[i].green;
+        in[i * 4 + 2] = src[i].blue;
+        in[i * 4 + 3] = src[i].opacity;
+    }
+    std::vector<double> across(image->rows * columns * 4);
+    std::vector<double> row(image->columns * 4);
+    std::vector<double> out;
+    for (unsigned long y = 0; y < image->rows; y++) {
+        row.assign(in.begin() + y * image->columns * 4, in.begin() + (y + 1) * image->columns * 4);
+        referenceResample(row, image->columns, columns, 4, filter, out);
+        std::copy(out.begin(), out.end(), across.begin() + y * columns * 4);
+    }
+    std::vector<double> want;
+    referenceResample(across, image->rows, rows, columns * 4, filter, want);
+    double worst = 0.0;
+    for (unsigned long i = 0; i < columns * rows; i++) {
+        double d[4] = {
+            fabs(want[i * 4] - got[i].red), fabs(want[i * 4 + 1] - got[i].green),
+            fabs(want[i * 4 + 2] - got[i].blue), fabs(want[i * 4 + 3] - got[i].opacity)
+        };
+        for (int c = 0; c < 4; c++) {
+            worst = d[c] > worst ? d[c] : worst;
+        }
+    }
+    check(worst <= RT_TOLERANCE, name + ": close to the floating point resize");
+
+    // the portable passes through the same tables must agree exactly
+    boost::shared_ptr<const trans::ResampleWeights> a = trans::resampleWeights(image->columns, columns, filter);
+    boost::shared_ptr<const trans::ResampleWeights> d = trans::resampleWeights(image->rows, rows, filter);
+    std::vector<PixelPacket> mid(image->rows * columns);
+    for (unsigned long y = 0; y < image->rows; y++) {
+        trans::resampleRowScalar(*a, src + y * image->columns, &mid[y * columns], columns);
+    }
+    std::vector<PixelPacket> scalar(columns * rows);
+    std::vector<const PixelPacket*> taps(d->taps);
+    for (unsigned long y = 0; y < rows; y++) {
+        for (unsigned int t = 0; t < d->taps; t++) {
+            taps[t] = &mid[(d->first[y] + t) * columns];
+        }
+        trans::resampleColumnScalar(*d, y, &taps[0], &scalar[y * columns], 0, columns);
+    }
+    bool same = true;
+    for (unsigned long i = 0; same && i < columns * rows; i++) {
+        same = scalar[i].red == got[i].red && scalar[i].green == got[i].green &&
+            scalar[i].blue == got[i].blue && scalar[i].opacity == got[i].opacity;
+    }
+    check(same, name + ": the same as the portable code");
+    DestroyImage(resized);
+}
+
+int
+main(int argc, char** argv) {
+    InitializeMagick(argv[0]);
+    checkTables();
+
+    // odd sized, with smooth ramps, noise and the hard edges of a
+    // checkerboard in the alpha channel
+    const unsigned long columns = 61;
+    const unsigned long rows = 37;
+    std::vector<unsigned char> pixels(columns * rows * 4);
+    srand(1);
+    for (unsigned long y = 0; y < rows; y++) {
+        for (unsigned long x = 0; x < columns; x++) {
+            unsigned char* p = &pixels[(y * columns + x) * 4];
+            p[0] = (unsigned char)(x * 255 / (columns - 1));
+            p[1] = (unsigned char)(y * 255 / (rows - 1));
+            p[2] = (unsigned char)(rand() & 255);
+            p[3] = ((x / 4 + y / 4) & 1) ? 255 : 0;
+        }
+    }
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    Image* image = ConstituteImage(columns, rows, "RGBA", CharPixel, &pixels[0], &exception);
+    DestroyExceptionInfo(&exception);
+    check(image != NULL, "made the test image");
+    if (image != NULL) {
+        unsigned long sizes[][2] = {
+            {20, 13}, {columns, rows}, {1, 1}, {1, rows}, {columns, 1}, {3 * columns, 3 * rows},
+            {7, 100}
+        };
+        for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            checkResize(image, sizes[s][0], sizes[s][1], trans::LanczosResample);
+            checkResize(image, sizes[s][0], sizes[s][1], trans::TriangleResample);
+        }
+        DestroyImage(image);
+    }
+
+    DestroyMagick();
+    if (s_failures > 0) {
+        std::cout << s_failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Rotate.hh"
+#include <assert.h>
+
+// the edge of the square tiles the transposes work in.  A tile of
+// source and a tile of destination pixels should sit in L1 together.
+#define ROTATE_TILE 64
+
+// copy pixels (and colormap indexes, if any) of a columns x rows source
+// into the destination, sending source (x, y) to destination
+// (dstX0 + x*dxx + y*dxy, dstY0 + x*dyx + y*dyy).  dstCols is the row
+// length of the destination.
+template <class T>
+static void
+transposeTiled(const T* src, T* dst, unsigned long columns, unsigned long rows,
+               unsigned long dstCols, long dstX0, long dstY0,
+               long dxx, long dxy, long dyx, long dyy) {
+    // stride in the destination for a step in source x and in source y
+    const long xStep = dxx + dyx * (long)dstCols;
+    const long yStep = dxy + dyy * (long)dstCols;
+    for (unsigned long ty = 0; ty < rows; ty += ROTATE_TILE) {
+        unsigned long yEnd = ty + ROTATE_TILE < rows ? ty + ROTATE_TILE : rows;
+        for (unsigned long tx = 0; tx < columns; tx += ROTATE_TILE) {
+            unsigned long xEnd = tx + ROTATE_TILE < columns ? tx + ROTATE_TILE : columns;
+            for (unsigned long y = ty; y < yEnd; y++) {
+                const T* s = src + y * columns + tx;
+                T* d = dst + (dstX0 + dstY0 * (long)dstCols) + (long)tx * xStep + (long)y * yStep;
+                for (unsigned long x = tx; x < xEnd; x++) {
+                    *d = *s++;
+                    d += xStep;
+                }
+            }
+        }
+    }
+}
+
+// reverse the order of n pixels
+template <class T>
+static void
+reverseCopy(const T* src, T* dst, unsigned long n) {
+    dst += n;
+    while (n--) {
+        *--dst = *src++;
+    }
+}
+
+Image*
+trans::rotateQuarterTurns(const Image* image, unsigned int turns, ExceptionInfo* exception) {
+    assert(turns >= 1 && turns <= 3);
+    const unsigned long columns = image->columns;
+    const unsigned long rows = image->rows;
+    const bool swap = (turns != 2);
+    Image* rotated = CloneImage(image, swap ? rows : columns, swap ? columns : rows, 1, exception);
+    if (rotated == NULL) {
+        return NULL;
+    }
+    const PixelPacket* src = AcquireImagePixels(image, 0, 0, columns, rows, exception);
+    if (src == NULL) {
+        DestroyImage(rotated);
+        return NULL;
+    }
+    const IndexPacket* srcIndexes = AccessImmutableIndexes(image);
+    PixelPacket* dst = SetImagePixels(rotated, 0, 0, rotated->columns, rotated->rows);
+    if (dst == NULL) {
+        DestroyImage(rotated);
+        return NULL;
+    }
+    IndexPacket* dstIndexes = AccessMutableIndexes(rotated);
+    if (image->storage_class != PseudoClass || rotated->storage_class != PseudoClass) {
+        srcIndexes = NULL;
+    }
+    if (turns == 2) {
+        // upside down, each source row lands reversed, last row first
+        for (unsigned long y = 0; y < rows; y++) {
+            reverseCopy(src + y * columns, dst + (rows - 1 - y) * columns, columns);
+            if (srcIndexes && dstIndexes) {
+                reverseCopy(srcIndexes + y * columns, dstIndexes + (rows - 1 - y) * columns, columns);
+            }
+        }
+    } else if (turns == 1) {
+        // (x, y) -> (rows - 1 - y, x)
+        transposeTiled(src, dst, columns, rows, rows, rows - 1, 0, 0, -1, 1, 0);
+        if (srcIndexes && dstIndexes) {
+            transposeTiled(srcIndexes, dstIndexes, columns, rows, rows, rows - 1, 0, 0, -1, 1, 0);
+        }
+    } else {
+        // (x, y) -> (y, columns - 1 - x)
+        transposeTiled(src, dst, columns, rows, rows, 0, columns - 1, 0, 1, -1, 0);
+        if (srcIndexes && dstIndexes) {
+            transposeTiled(srcIndexes, dstIndexes, columns, rows, rows, 0, columns - 1, 0, 1, -1, 0);
+        }
+    }
+    if (!SyncImagePixels(rotated)) {
+        DestroyImage(rotated);
+        return NULL;
+    }
+    // the page geometry rotates along with the pixels
+    RectangleInfo page = image->page;
+    if (swap) {
+        unsigned long w = page.width;
+        page.width = page.height;
+        page.height = w;
+        long x = page.x;
+        page.x = page.y;
+        page.y = x;
+    }
+    if (turns != 3 && page.width != 0) {
+        page.x = (long)(page.width - rotated->columns - page.x);
+    }
+    if (turns != 1 && page.height != 0) {
+        page.y = (long)(page.height - rotated->rows - page.y);
+    }
+    rotated->page = page;
+    return rotated;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runtime selection between scalar and SIMD implementations of pixel
+ * kernels.  Each kind of kernel has its own registry, and every
+ * implementation registers itself (from a static initializer in the
+ * file that defines it) with a priority and a test for whether the
+ * CPU we're running on supports it.  Callers ask for the best one.
+ *
+ * Files built with AVX2 (or any other optional) code generation must
+ * hold nothing but their kernels: inline or template code compiled there,
+ * this registry's included, could be the copy the linker keeps for the
+ * whole program and run on CPUs without AVX2.  They export a plain
+ * function pointer instead, which another file registers.
+ */
+
+#ifndef __SIMD_HH__
+#define __SIMD_HH__
+
+#include <vector>
+#include <assert.h>
+#include <stddef.h>
+
+namespace trans {
+    /** does the CPU (and OS) support SSE2 / AVX2 */
+    bool cpuHasSSE2();
+    bool cpuHasAVX2();
+
+    /** Kernel is a tag type which defines Func, the signature shared by
+     *  all implementations of the kernel */
+    template <class Kernel>
+    class KernelRegistry {
+    public:
+        typedef typename Kernel::Func Func;
+        struct Variant {
+            const char* name;
+            // the highest priority supported variant wins
+            int priority;
+            // NULL if supported everywhere
+            bool (*supported)();
+            Func func;
+        };
+        /** the registry for Kernel */
+        static KernelRegistry& instance() {
+            static KernelRegistry s_registry;
+            return s_registry;
+        }
+        /** variants are added at startup, which is when we pick the best
+         *  one, so the CPU is asked about each just once */
+        void add(const Variant& v) {
+            m_variants.push_back(v);
+            if ((m_best < 0 || v.priority > m_variants[m_best].priority) &&
+                (!v.supported || v.supported())) {
+                m_best = (int)m_variants.size() - 1;
+            }
+        }
+        /** the best variant the CPU supports */
+        const Variant& best() const {
+            // there's always a portable variant registered
+            assert(m_best >= 0);
+            return m_variants[m_best];
+        }
+    private:
+        KernelRegistry() : m_best(-1) { }
+        std::vector<Variant> m_variants;
+        int m_best;
+    };
+
+    /** declare one of these at file scope to register a variant.  A NULL
+     *  func, a variant this build couldn't compile, isn't registered. */
+    template <class Kernel>
+    class KernelRegistrar {
+    public:
+        KernelRegistrar(const char* name, int priority, bool (*supported)(),
+                        typename Kernel::Func func) {
+            if (!func) {
+                return;
+            }
+            typename KernelRegistry<Kernel>::Variant v;
+            v.name = name;
+            v.priority = priority;
+            v.supported = supported;
+            v.func = func;
+            KernelRegistry<Kernel>::instance().add(v);
+        }
+    };
+};
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SourceCache.hh"
+#include "Trace.hh"
+#include "bpservice/bpservice.h"
+#include <boost/filesystem.hpp>
+#include <sstream>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// the memory the pixels of an image list occupy
+static boost::uintmax_t
+imageBytes(const Image* image) {
+    boost::uintmax_t bytes = 0;
+    for (const Image* f = image; f; f = f->next) {
+        boost::uintmax_t pixels = (boost::uintmax_t)f->columns * f->rows;
+        bytes += pixels * sizeof(PixelPacket);
+        if (f->storage_class == PseudoClass) {
+            bytes += pixels * sizeof(IndexPacket);
+        }
+    }
+    return bytes;
+}
+
+// boost::filesystem::last_write_time() is only good to the second, and
+// a file rewritten at the same size within that second would look
+// unchanged, so the platform is asked directly
+#ifdef WIN32
+
+bool
+imageproc::SourceCache::stamp(const std::string& path, Stamp& stamp) {
+    WIN32_FILE_ATTRIBUTE_DATA attrs;
+    if (!GetFileAttributesExW(boost::filesystem::path(path).c_str(), GetFileExInfoStandard, &attrs)) {
+        return false;
+    }
+    stamp.size = ((boost::uintmax_t)attrs.nFileSizeHigh << 32) | attrs.nFileSizeLow;
+    // in 100 nanosecond ticks
+    boost::int64_t ticks = ((boost::int64_t)attrs.ftLastWriteTime.dwHighDateTime << 32) |
+        attrs.ftLastWriteTime.dwLowDateTime;
+    stamp.mtime = ticks * 100;
+    return true;
+}
+
+#else
+
+bool
+imageproc::SourceCache::stamp(const std::string& path, Stamp& stamp) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    stamp.size = (boost::uintmax_t)st.st_size;
+#ifdef __APPLE__
+    const struct timespec& mtime = st.st_mtimespec;
+#else
+    const struct timespec& mtime = st.st_mtim;
+#endif
+    stamp.mtime = (boost::int64_t)mtime.tv_sec * 1000000000 + mtime.tv_nsec;
+    return true;
+}
+
+#endif
+
+imageproc::SourceCache::SourceCache(boost::uintmax_t budget)
+    : m_budget(budget), m_bytes(0)
+{
+}
+
+imageproc::SourceCache::~SourceCache() {
+    while (!m_entries.empty()) {
+        erase(m_entries.begin());
+    }
+}
+
+Image*
+imageproc::SourceCache::lookup(const std::string& path, const Stamp& stamp, bool firstFrame) {
+    boost::mutex::scoped_lock lock(m_lock);
+    std::map<std::string, Entry>::iterator it = m_entries.find(path);
+    if (it == m_entries.end()) {
+        return NULL;
+    }
+    if (!(it->second.stamp == stamp)) {
+        // the file has changed
+        erase(it);
+        return NULL;
+    }
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    Image* copy;
+    if (firstFrame) {
+        copy = CloneImage(it->second.image, 0, 0, 1, &exception);
+    } else {
+        copy = CloneImageList(it->second.image, &exception);
+    }
+    DestroyExceptionInfo(&exception);
+    if (copy) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+    }
+    return copy;
+}
+
+void
+imageproc::SourceCache::insert(const std::string& path, const Stamp& stamp, const Image* image) {
+    boost::uintmax_t bytes = imageBytes(image);
+    if (bytes > m_budget) {
+        return;
+    }
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    Image* copy = CloneImageList(image, &exception);
+    DestroyExceptionInfo(&exception);
+    if (!copy) {
+        return;
+    }
+    boost::mutex::scoped_lock lock(m_lock);
+    std::map<std::string, Entry>::iterator it = m_entries.find(path);
+    if (it != m_entries.end()) {
+        erase(it);
+    }
+    while (m_bytes + bytes > m_budget && !m_lru.empty()) {
+        erase(m_entries.find(m_lru.back()));
+    }
+    m_lru.push_front(path);
+    Entry& e = m_entries[path];
+    e.stamp = stamp;
+    e.image = copy;
+    e.bytes = bytes;
+    e.lru = m_lru.begin();
+    m_bytes += bytes;
+    IA_LOG(BP_DEBUG, "cached decoded image, " << m_entries.size() << " images totalling " << m_bytes << " bytes");
+}
+
+// m_lock must be held
+void
+imageproc::SourceCache::erase(std::map<std::string, Entry>::iterator it) {
+    // copies handed out hold their own references to the pixels
+    DestroyImageList(it->second.image);
+    m_bytes -= it->second.bytes;
+    m_lru.erase(it->second.lru);
+    m_entries.erase(it);
+}
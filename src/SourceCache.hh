@@ -0,0 +1,99 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A cache of decoded images, so that transforming the same file again
+ * and again (say, as a user drags a slider) decodes it only once.
+ * Entries are keyed by path and remember the size and modification
+ * time of the file, to the finest resolution the platform records, so
+ * that a changed file is decoded afresh even if it's rewritten within
+ * the second.
+ */
+
+#ifndef __SOURCECACHE_HH__
+#define __SOURCECACHE_HH__
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include <magick/api.h>
+
+namespace imageproc {
+    class SourceCache {
+    public:
+        /** identifies a version of a file */
+        struct Stamp {
+            boost::uintmax_t size;
+            // modification time in nanoseconds, in whatever epoch and
+            // resolution the platform uses
+            boost::int64_t mtime;
+            bool operator==(const Stamp& other) const {
+                return size == other.size && mtime == other.mtime;
+            }
+        };
+        /** stamp the file at path.  returns false if it can't be stat'ed */
+        static bool stamp(const std::string& path, Stamp& stamp);
+        /** hold up to budget bytes of decoded pixels */
+        SourceCache(boost::uintmax_t budget);
+        ~SourceCache();
+        /** a copy of the image decoded from path, if it was stamped
+         *  stamp.  Copies share pixels with the cached image until either
+         *  is modified.  With firstFrame only the first frame is copied.
+         *  \returns NULL on a miss */
+        Image* lookup(const std::string& path, const Stamp& stamp, bool firstFrame);
+        /** remember image, the complete decode of path as of stamp.  The
+         *  cache keeps a (copy on write) copy. */
+        void insert(const std::string& path, const Stamp& stamp, const Image* image);
+    private:
+        struct Entry {
+            Stamp stamp;
+            Image* image;
+            boost::uintmax_t bytes;
+            // position in m_lru
+            std::list<std::string>::iterator lru;
+        };
+        void erase(std::map<std::string, Entry>::iterator it);
+        SourceCache(const SourceCache&);
+        SourceCache& operator=(const SourceCache&);
+
+        boost::uintmax_t m_budget;
+        boost::uintmax_t m_bytes;
+        boost::mutex m_lock;
+        std::map<std::string, Entry> m_entries;
+        // most recently used first
+        std::list<std::string> m_lru;
+    };
+};
+
+#endif
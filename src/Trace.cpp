@@ -0,0 +1,156 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Trace.hh"
+#include <list>
+#include <sstream>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+// spans kept per thread, older ones are overwritten
+#define TRACE_RING_EVENTS 8192
+
+// read on every span, so it has a lock of its own
+static boost::mutex s_enabledLock;
+static bool s_enabled = false;
+
+struct Event {
+    const char* name;
+    double start;
+    double end;
+};
+
+// a thread's recent spans.  the lock is only contended while dumping.
+struct Ring {
+    Ring(unsigned int t) : tid(t), next(0), wrapped(false) {
+        events.resize(TRACE_RING_EVENTS);
+    }
+    boost::mutex lock;
+    unsigned int tid;
+    std::vector<Event> events;
+    unsigned int next;
+    bool wrapped;
+};
+
+// rings outlive their threads so their spans can still be dumped
+static boost::mutex s_ringsLock;
+static std::list<boost::shared_ptr<Ring> > s_rings;
+
+static void
+noCleanup(Ring*) {
+}
+static boost::thread_specific_ptr<Ring> s_ring(&noCleanup);
+
+static Ring*
+threadRing() {
+    Ring* r = s_ring.get();
+    if (r == NULL) {
+        boost::mutex::scoped_lock lock(s_ringsLock);
+        boost::shared_ptr<Ring> ring(new Ring(s_rings.size() + 1));
+        s_rings.push_back(ring);
+        r = ring.get();
+        s_ring.reset(r);
+    }
+    return r;
+}
+
+static void
+appendString(std::stringstream& ss, const char* s) {
+    ss << '"';
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            ss << '\\';
+        }
+        ss << *s;
+    }
+    ss << '"';
+}
+
+void
+imageproc::trace::enable(bool on) {
+    boost::mutex::scoped_lock lock(s_enabledLock);
+    s_enabled = on;
+}
+
+bool
+imageproc::trace::enabled() {
+    boost::mutex::scoped_lock lock(s_enabledLock);
+    return s_enabled;
+}
+
+void
+imageproc::trace::record(const char* name, double startMillis, double endMillis) {
+    Ring* r = threadRing();
+    boost::mutex::scoped_lock lock(r->lock);
+    Event& e = r->events[r->next];
+    e.name = name;
+    e.start = startMillis;
+    e.end = endMillis;
+    if (++r->next == r->events.size()) {
+        r->next = 0;
+        r->wrapped = true;
+    }
+}
+
+std::string
+imageproc::trace::toJson() {
+    std::stringstream ss;
+    ss.setf(std::ios::fixed);
+    ss.precision(3);
+    ss << "{\"traceEvents\":[";
+    bool first = true;
+    boost::mutex::scoped_lock lock(s_ringsLock);
+    std::list<boost::shared_ptr<Ring> >::iterator it;
+    for (it = s_rings.begin(); it != s_rings.end(); ++it) {
+        Ring& r = **it;
+        boost::mutex::scoped_lock ringLock(r.lock);
+        unsigned int n = r.wrapped ? r.events.size() : r.next;
+        unsigned int begin = r.wrapped ? r.next : 0;
+        for (unsigned int i = 0; i < n; i++) {
+            const Event& e = r.events[(begin + i) % r.events.size()];
+            if (!first) {
+                ss << ",";
+            }
+            first = false;
+            // trace_event times are in microseconds
+            ss << "\n{\"name\":";
+            appendString(ss, e.name);
+            ss << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << r.tid
+               << ",\"ts\":" << e.start * 1000.0
+               << ",\"dur\":" << (e.end - e.start) * 1000.0 << "}";
+        }
+    }
+    ss << "\n]}\n";
+    return ss.str();
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Lightweight tracing.  Spans are recorded into a ring buffer per
+ * thread and can be dumped as Chrome trace_event JSON (load it in
+ * chrome://tracing).  Recording is off until enabled at runtime, when a
+ * span costs a test of a flag.  Building with IA_NO_TRACE defined
+ * compiles the macros away entirely.
+ *
+ *   IA_TRACE_SCOPE("decode");    // a span lasting until end of scope
+ *
+ * Span names are not copied, they must be string literals or otherwise
+ * live as long as the process.
+ *
+ * The info and debug level log messages about each image are only
+ * formatted and logged while tracing is on:
+ *
+ *   IA_LOG(BP_INFO, "decoding " << x << "x" << y);
+ */
+
+#ifndef __TRACE_HH__
+#define __TRACE_HH__
+
+#include <string>
+#include <sstream>
+#include "bpservice/bpservice.h"
+#include "Profile.hh"
+
+namespace imageproc {
+    namespace trace {
+        /** turn recording on or off */
+        void enable(bool on);
+        /** is recording on? */
+        bool enabled();
+        /** record a span of the calling thread, times as from
+         *  monotonicMillis() */
+        void record(const char* name, double startMillis, double endMillis);
+        /** everything recorded and still in the rings, as Chrome
+         *  trace_event JSON */
+        std::string toJson();
+
+        class Span {
+        public:
+            Span(const char* name)
+                : m_name(name), m_start(enabled() ? monotonicMillis() : -1.0) { }
+            ~Span() {
+                if (m_start >= 0.0) {
+                    record(m_name, m_start, monotonicMillis());
+                }
+            }
+        private:
+            const char* m_name;
+            double m_start;
+        };
+    };
+};
+
+#ifdef IA_NO_TRACE
+#define IA_TRACE_SCOPE(name)
+#else
+#define IA_TRACE_CAT2(a, b) a##b
+#define IA_TRACE_CAT(a, b) IA_TRACE_CAT2(a, b)
+#define IA_TRACE_SCOPE(name) \
+    imageproc::trace::Span IA_TRACE_CAT(iaTraceSpan, __LINE__)(name)
+#endif
+
+#define IA_LOG(level, msg) \
+    do { \
+        if (imageproc::trace::enabled()) { \
+            std::stringstream iaLogStream; \
+            iaLogStream << msg; \
+            bplus::service::Service::log(level, iaLogStream.str()); \
+        } \
+    } while (0)
+
+#endif
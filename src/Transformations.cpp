@@ -1,12 +1,57 @@
 #include "Transformations.hh"
+#include "Rotate.hh"
+#include "Resample.hh"
+#include "Trace.hh"
 #include <sstream>
 #include <assert.h>
+#include <math.h>
 #include <string.h>
 
 #ifdef WIN32
 #define strcasecmp _stricmp
 #endif
 
+// give a transformation that works in place a copy of the input to
+// work on
+static Image*
+cloneAndTransform(trans::InPlaceTransformationFunc func, const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
+    DestroyExceptionInfo(&exception);
+    if (!i) {
+        oError.append("couldn't clone image :/");
+        return NULL;
+    }
+    return func(i, args, quality, oError);
+}
+
+// run a single pixel-local transformation by compiling it into a
+// kernel of its own
+static Image*
+pointTransform(trans::PointOperationFunc op, const Image* inImage, const bplus::Object* args, std::string& oError) {
+    trans::PointKernel kernel;
+    if (!op(kernel, args, oError)) {
+        return NULL;
+    }
+    ExceptionInfo exception;
+    GetExceptionInfo(&exception);
+    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
+    if (!i) {
+        oError.append("couldn't clone image :/");
+    } else if (!kernel.apply(i, oError)) {
+        DestroyImage(i);
+        i = NULL;
+    }
+    DestroyExceptionInfo(&exception);
+    return i;
+}
+
+static bool
+noopPointOp(trans::PointKernel& kernel, const bplus::Object* args, std::string& oError) {
+    return true;
+}
+
 static Image*
 noopTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
     ExceptionInfo exception;
@@ -61,57 +106,45 @@ enhanceTransform(const Image* inImage, const bplus::Object* args, int quality, s
     return i;
 }
 
+static bool
+solarizePointOp(trans::PointKernel& kernel, const bplus::Object* args, std::string& oError) {
+    kernel.solarize(1.0);
+    return true;
+}
+
 static Image*
 solarizeTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
-    ExceptionInfo exception;
-    GetExceptionInfo(&exception);
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (i == NULL) {
-        oError.append("couldn't clone image :/");
-    } else if (!SolarizeImage(i, 1.0)) {
-        oError.append("error during solarization occured");
-        DestroyImage(i);
-        i = NULL;
-    }
-    DestroyExceptionInfo(&exception);
-    return i;
+    return pointTransform(solarizePointOp, inImage, args, oError);
 }
 
-static Image*
-contrastTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+static bool
+contrastPointOp(trans::PointKernel& kernel, const bplus::Object* args, std::string& oError) {
     int contrast = 1;
     if (args) {
         if (args->type() != BPTInteger) {
             oError.append("contrast takes a single numeric argument between -10 and 10");
-            return NULL;
+            return false;
         }
         contrast = (int)((long long)*args);
     }
-    ExceptionInfo exception;
-    GetExceptionInfo(&exception);
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (!i) {
-        oError.append("couldn't clone image :/");
-    } else {
-        int sharpen = 1;
-        if (contrast < 0) {
-            sharpen = 0;
-            contrast *= -1;
-        }
-        if (contrast > 10) {
-            contrast = 10;
-        }
-        for (int x = 0; x < contrast; x++) {
-            if (!ContrastImage(i, sharpen)) {
-                oError.append("error during contrast occured");
-                DestroyImage(i);
-                i = NULL;
-                break;
-            }
-        }
+    bool sharpen = true;
+    if (contrast < 0) {
+        sharpen = false;
+        contrast *= -1;
     }
-    DestroyExceptionInfo(&exception);
-    return i;
+    if (contrast > 10) {
+        contrast = 10;
+    }
+    // all iterations are applied to each pixel within a single pass
+    if (contrast > 0) {
+        kernel.contrast(sharpen, contrast);
+    }
+    return true;
+}
+
+static Image*
+contrastTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    return pointTransform(contrastPointOp, inImage, args, oError);
 }
 
 static Image*
@@ -123,9 +156,9 @@ oilpaintTransform(const Image* inImage, const bplus::Object* args, int quality,
     return i;
 }
 
-static Image*
-rotateTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
-    double degrees = 90;
+bool
+trans::rotationDegrees(const bplus::Object* args, double& degrees, std::string& oError) {
+    degrees = 90;
     if (args != NULL) {
         if (args->type() == BPTDouble) {
             degrees = (double)*args;
@@ -133,12 +166,32 @@ rotateTransform(const Image* inImage, const bplus::Object* args, int quality, st
             degrees = (double)((long long)(*args));
         } else {
             oError.append("rotate accepts a single optional numeric argument");
-            return NULL;
+            return false;
         }
     }
+    return true;
+}
+
+static Image*
+rotateTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    double degrees;
+    if (!trans::rotationDegrees(args, degrees, oError)) {
+        return NULL;
+    }
     ExceptionInfo exception;
     GetExceptionInfo(&exception);
-    Image* i = RotateImage(inImage, degrees, &exception);
+    Image* i;
+    // whole quarter turns are just a transpose and/or flip of the
+    // pixels, which needn't go through the general rotation
+    double turns = fmod(degrees, 360.0) / 90.0;
+    if (turns < 0) {
+        turns += 4;
+    }
+    if (turns == floor(turns) && turns != 0) {
+        i = trans::rotateQuarterTurns(inImage, (unsigned int)turns, &exception);
+    } else {
+        i = RotateImage(inImage, degrees, &exception);
+    }
     DestroyExceptionInfo(&exception);
     return i;
 }
@@ -163,12 +216,11 @@ swirlTransform(const Image* inImage, const bplus::Object* args, int quality, std
     return i;
 }
 
-static bool
-extractScalingDimensions(const char* funcName, const Image* inImage, const bplus::Object* args, unsigned int& x, unsigned int& y, std::string& oError) {
-    x = 0;
-    y = 0;
-    int maxwidth = -1;
-    int maxheight = -1;
+bool
+trans::scalingBounds(const char* funcName, const bplus::Object* args, int& maxwidth, int& maxheight, bool& draft, std::string& oError) {
+    draft = false;
+    maxwidth = -1;
+    maxheight = -1;
     assert(args != NULL);
     if (args->type() != BPTMap) {
         oError.append(funcName);
@@ -186,6 +238,16 @@ extractScalingDimensions(const char* funcName, const Image* inImage, const bplus
         else if (!strcasecmp("maxheight", k)) {
             num = &maxheight;
         }
+        else if (!strcasecmp("draft", k)) {
+            if (v->type() != BPTBoolean) {
+                std::stringstream ss;
+                ss << k << " requires a boolean argument";
+                oError = ss.str();
+                return false;
+            }
+            draft = (bool)*v;
+            continue;
+        }
         else {
             std::stringstream ss;
             ss << "invalid argument to " << funcName << ": " << k;
@@ -200,13 +262,23 @@ extractScalingDimensions(const char* funcName, const Image* inImage, const bplus
         }
         *num = (int)((long long)*v);
     }
+    return true;
+}
+
+bool
+trans::scalingDimensions(const char* funcName, unsigned int inX, unsigned int inY, const bplus::Object* args, unsigned int& x, unsigned int& y, bool& draft, std::string& oError) {
+    x = 0;
+    y = 0;
+    int maxwidth;
+    int maxheight;
+    if (!scalingBounds(funcName, args, maxwidth, maxheight, draft, oError)) {
+        return false;
+    }
     // wow.  parsing arguments is lame.  but we did it. maxheight and
     // maxwidth now contain values that we should constrain to
     // first we'll determine the size of the input
-    x = inImage->columns;
-    y = inImage->rows;
-    unsigned int origx = x;
-    unsigned int origy = y;
+    x = inX;
+    y = inY;
     if (maxwidth <= 0) {
         maxwidth = x;
     }
@@ -225,10 +297,17 @@ extractScalingDimensions(const char* funcName, const Image* inImage, const bplus
         x *= scale;
         y *= scale;
     }
+    return true;
+}
+
+static bool
+extractScalingDimensions(const char* funcName, const Image* inImage, const bplus::Object* args, unsigned int& x, unsigned int& y, std::string& oError) {
+    bool draft;
+    if (!trans::scalingDimensions(funcName, inImage->columns, inImage->rows, args, x, y, draft, oError)) {
+        return false;
+    }
     // log about it
-    std::stringstream ss;
-    ss << "scaling parameters [mw: " << maxwidth << " | mh: " << maxheight << "]: from (" << origx << ", " << origy << ") to (" << x << ", " << y << ")";
-    bplus::service::Service::log(BP_INFO, ss.str());
+    IA_LOG(BP_INFO, "scaling parameters: from (" << inImage->columns << ", " << inImage->rows << ") to (" << x << ", " << y << ")");
     return true;
 }
 
@@ -240,7 +319,12 @@ static Image* scaleTransform(const Image* inImage, const bplus::Object* args, in
     }
     ExceptionInfo exception;
     GetExceptionInfo(&exception);
-    Image* img = ResizeImage(inImage, x, y, LanczosFilter, 1.0, &exception);
+    Image* img;
+    if (trans::nativeResampler()) {
+        img = trans::resampleImage(inImage, x, y, trans::LanczosResample, &exception);
+    } else {
+        img = ResizeImage(inImage, x, y, LanczosFilter, 1.0, &exception);
+    }
     DestroyExceptionInfo(&exception);
     return img;
 }
@@ -254,19 +338,34 @@ thumbnailTransform(const Image* inImage, const bplus::Object* args, int quality,
     }
     ExceptionInfo exception;
     GetExceptionInfo(&exception);
-    Image* img = ThumbnailImage(inImage, x, y, &exception);
+    Image* img;
+    if (trans::nativeResampler()) {
+        const Image* from = inImage;
+        Image* sampled = NULL;
+        if ((double)x / inImage->columns * y / inImage->rows <= THUMBNAIL_SAMPLE_AREA) {
+            sampled = SampleImage(inImage, THUMBNAIL_SAMPLE_FACTOR * x, THUMBNAIL_SAMPLE_FACTOR * y,
+                                  &exception);
+            from = sampled;
+        }
+        img = from ? trans::resampleImage(from, x, y, trans::LanczosResample, &exception) : NULL;
+        if (sampled) {
+            DestroyImage(sampled);
+        }
+    } else {
+        img = ThumbnailImage(inImage, x, y, &exception);
+    }
     DestroyExceptionInfo(&exception);
     return img;
 }
 
-static Image*
-cropTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+bool
+trans::cropRegion(unsigned int x, unsigned int y, const bplus::Object* args, RectangleInfo& ri, std::string& oError) {
     // first we'll validate and extract parameters
     double cropParams[4];
     assert(args != NULL);
     if (!args || args->type() != BPTList || ((const bplus::List *) args)->size() != 4) {
         oError.append("crop accepts an array of four floating point numbers");
-        return NULL;
+        return false;
     }
     const bplus::List* l = (const bplus::List*)args;
     for (unsigned int i = 0; i < 4; i++) {
@@ -276,7 +375,7 @@ cropTransform(const Image* inImage, const bplus::Object* args, int quality, std:
             cropParams[i] = (double)((long long)*(l->value(i)));
         } else {
             oError.append("crop accepts an array of four floating point numbers");
-            return NULL;
+            return false;
         }
         if (cropParams[i] < 0.0) {
             cropParams[i] = 0.0;
@@ -288,22 +387,26 @@ cropTransform(const Image* inImage, const bplus::Object* args, int quality, std:
     // validate arguments
     if (cropParams[0] >= cropParams[2] || cropParams[1] >= cropParams[3]) {
         oError.append("meaningless crop parameters (x1/y1 may not be greater than x2/y2)");
-        return NULL;
+        return false;
     }
     // cropParams now contains x1, y1, x2, y2 in relative cordinates,
     // with origin at top left of image.  We'll use that information to
     // populate a RectangleInfo structure
-    // extract existing image size
-    unsigned int x = inImage->magick_columns;
-    unsigned int y = inImage->magick_rows;
-    RectangleInfo ri;
     ri.height = y * (cropParams[3] - cropParams[1]);
     ri.width = x * (cropParams[2] - cropParams[0]);
     ri.x = x * cropParams[0];
     ri.y = y * cropParams[1];
-    std::stringstream ss;
-    ss << "Cropping image (" << x << "x" << y << "): " << ri.width << "x" << ri.height << " starting at " << ri.x << "," << ri.y;
-    bplus::service::Service::log(BP_INFO, ss.str());
+    IA_LOG(BP_INFO, "Cropping image (" << x << "x" << y << "): " << ri.width << "x" << ri.height << " starting at " << ri.x << "," << ri.y);
+    return true;
+}
+
+static Image*
+cropTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    // crop coordinates are relative to the original image size
+    RectangleInfo ri;
+    if (!trans::cropRegion(inImage->magick_columns, inImage->magick_rows, args, ri, oError)) {
+        return NULL;
+    }
     ExceptionInfo exception;
     GetExceptionInfo(&exception);
     Image* img = CropImage(inImage, &ri, &exception);
@@ -312,184 +415,135 @@ cropTransform(const Image* inImage, const bplus::Object* args, int quality, std:
 }
 
 static Image*
-equalizeTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
-    ExceptionInfo exception;
-    GetExceptionInfo(&exception);
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (!i) {
-        oError.append("couldn't clone image :/");
-    } else if (!EqualizeImage(i)) {
+equalizeInPlace(Image* image, const bplus::Object* args, int quality, std::string& oError) {
+    if (!EqualizeImage(image)) {
         oError.append("error occured during equalization");
-        DestroyImage(i);
-        i = NULL;
+        DestroyImage(image);
+        return NULL;
     }
-    DestroyExceptionInfo(&exception);
-    return i;
+    return image;
 }
 
 static Image*
-normalizeTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
-    ExceptionInfo exception;
-    GetExceptionInfo(&exception);
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (!i) {
-        oError.append("couldn't clone image :/");
-    } else if (!NormalizeImage(i)) {
+equalizeTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    return cloneAndTransform(equalizeInPlace, inImage, args, quality, oError);
+}
+
+static Image*
+normalizeInPlace(Image* image, const bplus::Object* args, int quality, std::string& oError) {
+    if (!NormalizeImage(image)) {
         oError.append("error occured during normalization");
-        DestroyImage(i);
-        i = NULL;
+        DestroyImage(image);
+        return NULL;
     }
-    DestroyExceptionInfo(&exception);
-    return i;
+    return image;
 }
 
 static Image*
-ditherTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
-    ExceptionInfo exception;
-    GetExceptionInfo(&exception);
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (!i) {
-        oError.append("couldn't clone image :/");
-    } else if (!OrderedDitherImage(i)) {
+normalizeTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    return cloneAndTransform(normalizeInPlace, inImage, args, quality, oError);
+}
+
+static Image*
+ditherInPlace(Image* image, const bplus::Object* args, int quality, std::string& oError) {
+    if (!OrderedDitherImage(image)) {
         oError.append("error occured during ditherizasification");
-        DestroyImage(i);
-        i = NULL;
+        DestroyImage(image);
+        return NULL;
     }
-    DestroyExceptionInfo(&exception);
-    return i;
+    return image;
 }
 
 static Image*
-grayscaleTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
-    ExceptionInfo exception;
-    QuantizeInfo qi;
-    GetExceptionInfo(&exception);
-    GetQuantizeInfo(&qi);
-    qi.colorspace = GRAYColorspace;
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (!i) {
-        oError.append("couldn't clone image :/");
-    } else if (!QuantizeImage(&qi, i)) {
-        oError.append("error during grayscale quantize phase occured");
-        DestroyImage(i);
-        i = NULL;
+ditherTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    return cloneAndTransform(ditherInPlace, inImage, args, quality, oError);
+}
+
+static bool
+grayscalePointOp(trans::PointKernel& kernel, const bplus::Object* args, std::string& oError) {
+    trans::Luma luma = trans::Rec601Luma;
+    // 'greyscale' used to require an argument it ignored, which callers
+    // passed as true, so a boolean still means the default
+    bool valid = (args == NULL || args->type() == BPTNull || args->type() == BPTBoolean);
+    if (args != NULL && args->type() == BPTString) {
+        std::string weighting = (std::string)*args;
+        if (!strcasecmp(weighting.c_str(), "rec709")) {
+            luma = trans::Rec709Luma;
+            valid = true;
+        } else if (!strcasecmp(weighting.c_str(), "rec601")) {
+            valid = true;
+        }
     }
-    //DestroyQuantizeInfo(&qi);
-    DestroyExceptionInfo(&exception);
-    return i;
+    if (!valid) {
+        oError.append("grayscale accepts a single optional string argument, "
+                      "\"rec601\" or \"rec709\"");
+        return false;
+    }
+    kernel.grayscale(luma);
+    return true;
 }
 
 static Image*
-psychedelicTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
-    ExceptionInfo exception;
-    GetExceptionInfo(&exception);
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (!i) {
-        oError.append("couldn't clone image :/");
-    } else if (!CycleColormapImage(i, 8)) {
+grayscaleTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    return pointTransform(grayscalePointOp, inImage, args, oError);
+}
+
+static Image*
+psychedelicInPlace(Image* image, const bplus::Object* args, int quality, std::string& oError) {
+    if (!CycleColormapImage(image, 8)) {
         oError.append("error during psychedlic occured");
-        DestroyImage(i);
-        i = NULL;
+        DestroyImage(image);
+        return NULL;
     }
-    DestroyExceptionInfo(&exception);
-    return i;
+    return image;
+}
+
+static Image*
+psychedelicTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    return cloneAndTransform(psychedelicInPlace, inImage, args, quality, oError);
+}
+
+static bool
+negatePointOp(trans::PointKernel& kernel, const bplus::Object* args, std::string& oError) {
+    kernel.negate();
+    return true;
 }
 
 static Image*
 negateTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
-    ExceptionInfo exception;
-    GetExceptionInfo(&exception);
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (!i) {
-        oError.append("couldn't clone image :/");
-    } else if (!NegateImage(i, 0)) {
-        oError.append("error during negate occured");
-        DestroyImage(i);
-        i = NULL;
-    }
-    DestroyExceptionInfo(&exception);
-    return i;
+    return pointTransform(negatePointOp, inImage, args, oError);
 }
 
-static MagickPassFail sepiaWorker(void* mutable_data,         /* User provided mutable data */
-                                  const void* immutable_data, /* User provided immutable data */
-                                  Image* image,               /* Modify image */
-                                  PixelPacket* pixels,        /* Pixel row */
-                                  IndexPacket* indexes,       /* Pixel row indexes */
-                                  const long npixels,         /* Number of pixels in row */
-                                  ExceptionInfo* exception) { /* Exception report */
-    // Modified version of algorithm from:
-    //     http://blogs.techrepublic.com.com/howdoi/?p=120
-    //
-    for (long i=0; i < npixels; i++) {
-        float r1 = (float)pixels[i].red;
-        float g1 = (float)pixels[i].green;
-        float b1 = (float)pixels[i].blue;
-        // Changed the factors to
-        //   (1) make filter less yellow and
-        //   (2) make filter less bright
-        float r2 = (r1 * 0.373 + g1 * 0.731 + b1 * 0.180);
-        float g2 = (r1 * 0.298 + g1 * 0.586 + b1 * 0.143);
-        float b2 = (r1 * 0.219 + g1 * 0.431 + b1 * 0.105);
-        // Original factors
-        // float r2 = (r1 * .393 + g1 *.769 + b1 * .189);
-        // float g2 = (r1 * .349 + g1 *.686 + b1 * .168);
-        // float b2 = (r1 * .272 + g1 *.534 + b1 * .131);
-        if (r2 > MaxRGB) {
-            r2 = MaxRGB;
-        }
-        if (g2 > MaxRGB) {
-            g2 = MaxRGB;
-        }
-        if (b2 > MaxRGB) {
-            b2 = MaxRGB;
-        }
-        pixels[i].red   = r2;
-        pixels[i].green = g2;
-        pixels[i].blue  = b2;
-    }
-    return MagickPass;
+// Modified version of algorithm from:
+//     http://blogs.techrepublic.com.com/howdoi/?p=120
+//
+// Changed the factors to
+//   (1) make filter less yellow and
+//   (2) make filter less bright
+static const double s_sepiaMatrix[3][3] = {
+    { 0.373, 0.731, 0.180 },
+    { 0.298, 0.586, 0.143 },
+    { 0.219, 0.431, 0.105 }
+};
+// Original factors
+//    { .393, .769, .189 },
+//    { .349, .686, .168 },
+//    { .272, .534, .131 }
+
+static bool
+sepiaPointOp(trans::PointKernel& kernel, const bplus::Object* args, std::string& oError) {
+    // Remove contrast.  Could blow up the highlights on certain pictures.
+    // Let the user add contrast if required.
+    kernel.colorMatrix(s_sepiaMatrix);
+    return true;
 }
 
 static Image* sepiaTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
-    MagickPassFail status = MagickPass;
-    ExceptionInfo exception;
-    GetExceptionInfo(&exception);
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (!i) {
-        oError.append("couldn't clone image :/");
-    } else {
-        status = PixelIterateMonoModify(sepiaWorker,
-                                        NULL,       // const PixelIteratorOptions *options
-                                        NULL,       // const char *description
-                                        NULL,       // void *mutable_data
-                                        NULL,       // const void *immutable_data
-                                        0,          // const long x
-                                        0,          // const long y
-                                        i->columns, // const unsigned long columns,
-                                        i->rows,    // const unsigned long rows,
-                                        i,
-                                        &exception);
-        if (status == MagickFail) {
-            oError.append("error during sepia quanitzation occured");
-            DestroyImage(i);
-            i = NULL;
-        } else {
-            // Remove contrast.  Could blow up the highlights on certain pictures.
-            // Let the user add contrast if required.
-#if 0
-            // Add some little contrast to sepia toned image.  Looks much better with contrast.
-            i = contrastTransform(i, NULL, 100, oError);
-#endif // 0
-
-        }
-    }
-    DestroyExceptionInfo(&exception);
-    return i;
+    return pointTransform(sepiaPointOp, inImage, args, oError);
 }
 
-static Image*
-thresholdTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+static bool
+thresholdPointOp(trans::PointKernel& kernel, const bplus::Object* args, std::string& oError) {
     double threshold = 128.0;
     if (args != NULL) {
         if (args->type() == BPTDouble) {
@@ -498,7 +552,7 @@ thresholdTransform(const Image* inImage, const bplus::Object* args, int quality,
             threshold = (double)((long long)(*args));
         } else {
             oError.append("threshold accepts a single optional numeric argument");
-            return NULL;
+            return false;
         }
     }
     if (threshold < 0.0) {
@@ -507,18 +561,17 @@ thresholdTransform(const Image* inImage, const bplus::Object* args, int quality,
     if (threshold > 256.0) {
         threshold = 256.0;
     }
-    ExceptionInfo exception;
-    GetExceptionInfo(&exception);
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (!ThresholdImage(i, threshold)) {
-        DestroyImage(i);
-        i = NULL;
-    }
-    DestroyExceptionInfo(&exception);
-    return i;
+    kernel.threshold(threshold);
+    return true;
 }
 
-static Image* blackThresholdTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+static Image*
+thresholdTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    return pointTransform(thresholdPointOp, inImage, args, oError);
+}
+
+static bool
+blackThresholdPointOp(trans::PointKernel& kernel, const bplus::Object* args, std::string& oError) {
     double threshold = 50.0;
     if (args != NULL) {
         if (args->type() == BPTDouble) {
@@ -527,7 +580,7 @@ static Image* blackThresholdTransform(const Image* inImage, const bplus::Object*
             threshold = (double)((long long)(*args));
         } else {
             oError.append("black_threshold accepts a single optional numeric argument");
-            return NULL;
+            return false;
         }
     }
     if (threshold < 0.0) {
@@ -536,133 +589,136 @@ static Image* blackThresholdTransform(const Image* inImage, const bplus::Object*
     if (threshold > 100.0) {
         threshold = 100.0;
     }
-    char thresholdString[10];
-    sprintf(thresholdString, "%d%%", (int) threshold);
-    ExceptionInfo exception;
-    GetExceptionInfo(&exception);
-    Image* i = CloneImage(inImage, 0, 0, 1, &exception);
-    if (!BlackThresholdImage(i, thresholdString)) {
-        DestroyImage(i);
-        i = NULL;
-    }
-    DestroyExceptionInfo(&exception);
-    return i;
+    // whole percentages of MaxRGB, as BlackThresholdImage("n%") used
+    kernel.blackThreshold(MaxRGBDouble * (int)threshold / 100.0);
+    return true;
+}
+
+static Image* blackThresholdTransform(const Image* inImage, const bplus::Object* args, int quality, std::string& oError) {
+    return pointTransform(blackThresholdPointOp, inImage, args, oError);
 }
 
 static trans::Transformation s_transMap[] = {
     {
-        "contrast", true, false, contrastTransform,
+        "contrast", true, false, contrastTransform, NULL, contrastPointOp,
         "adjust the image's contrast, accepts an optional numeric argument "
         "between -10 and 10"
     },
     {
-        "black_threshold", true, false, blackThresholdTransform,
+        "black_threshold", true, false, blackThresholdTransform, NULL, blackThresholdPointOp,
         "Given a threshold (in terms of percentage from 0-100), color all "
         "pixels which fall under that threshold black."
     },
     {
-        "blur", false, false, blurTransform,
+        "blur", false, false, blurTransform, NULL, NULL,
         "blur (or 'smooth') an image"
     },
     {
-        "crop", true, true, cropTransform,
+        "crop", true, true, cropTransform, NULL, NULL,
         "select a subset of an image, accepts an array of four floating point "
         "numbers: x1,y1,x2,y2 which are between 0.0 and 1.0 and are relative "
         "coordinates to the upper left hand corner of the image"
     },
     {
-        "despeckle", false, false, despeckleTransform,
+        "despeckle", false, false, despeckleTransform, NULL, NULL,
         "reduces the speckle noise in an image while perserving the edges of "
         "the original image, accepts no arguments"
     },
     {
-        "dither", false, false, ditherTransform,
+        "dither", false, false, ditherTransform, ditherInPlace, NULL,
         "Uses the ordered dithering technique of reducing color images to monochrome using positional information to retain as much information as possible."
     },
     {
-        "enhance", false, false, enhanceTransform,
+        "enhance", false, false, enhanceTransform, NULL, NULL,
         "Applies a digital filter that improves the quality of a noisy image, "
         "accepts no arguments "
     },
     {
-        "equalize", false, false, equalizeTransform,
+        "equalize", false, false, equalizeTransform, equalizeInPlace, NULL,
         "Applies a histogram equalization to the image."
     },
 
     {
-        "grayscale", false, false, grayscaleTransform,
-        "remove the color from an image, accepts no arguments"
+        "grayscale", true, false, grayscaleTransform, NULL, grayscalePointOp,
+        "remove the color from an image.  optionally a string argument "
+        "selects the weighting of red, green and blue: \"rec601\" (the "
+        "default) or \"rec709\""
     },
     {
-        "greyscale", true, true, grayscaleTransform,
+        "greyscale", true, false, grayscaleTransform, NULL, grayscalePointOp,
         "an alias for 'grayscale'"
     },
     {
-        "negate", false, false, negateTransform,
+        "negate", false, false, negateTransform, NULL, negatePointOp,
         "negate the colors of the image, accepts no arguments"
     },
     {
-        "noop", false, false, noopTransform,
+        "noop", false, false, noopTransform, NULL, noopPointOp,
         "do nothing.  may be applied multiple times.  still does nothing."
     },
     {
-        "normalize", false, false, normalizeTransform,
+        "normalize", false, false, normalizeTransform, normalizeInPlace, NULL,
         "Enhances the contrast of a color image by adjusting the pixels color to span the entire range of colors available."
     },
     {
-        "oilpaint", false, false, oilpaintTransform,
+        "oilpaint", false, false, oilpaintTransform, NULL, NULL,
         "an effect that will make the image look like an oil painting, "
         "accepts no arguments"
     },
     {
-        "psychedelic", false, false, psychedelicTransform,
+        "psychedelic", false, false, psychedelicTransform, psychedelicInPlace, NULL,
         "trip out an image.  takes no arguments.  may be applied multiple "
         "times."
     },
     {
-        "rotate", true, false, rotateTransform,
+        "rotate", true, false, rotateTransform, NULL, NULL,
         "rotate an image by some number of degrees, takes a single numeric "
         "argument"
     },
     {
-        "scale", true, true, scaleTransform,
+        "scale", true, true, scaleTransform, NULL, NULL,
         "downscale an image preserving aspect ratio.  you may provide the "
         "integer arguments maxwidth and/or maxheight which limit the image "
-        "in the specified direction.  units are pixels."
+        "in the specified direction.  units are pixels.  When this is the "
+        "first action, the boolean argument draft allows JPEG images to be "
+        "decoded at a reduced size (1/2, 1/4 or 1/8) no smaller than the "
+        "result, which is much faster at a slight cost in quality."
     },
     {
-        "sepia", false, false, sepiaTransform,
+        "sepia", false, false, sepiaTransform, NULL, sepiaPointOp,
         "sepia tone an image.  no arguments."
     },
     {
-        "sharpen", false, false, sharpenTransform,
+        "sharpen", false, false, sharpenTransform, NULL, NULL,
         "sharpen an image"
     },
     {
-        "solarize", false, false, solarizeTransform,
+        "solarize", false, false, solarizeTransform, NULL, solarizePointOp,
         "solarize an image.  no arguments"
     },
     {
-        "swirl", true, true, swirlTransform,
+        "swirl", true, true, swirlTransform, NULL, NULL,
         "swirl an image.  optionally a numeric argument specifies the degrees "
         "to swirl, default is 90 degrees."
     },
     {
-        "threshold", true, false, thresholdTransform,
+        "threshold", true, false, thresholdTransform, NULL, thresholdPointOp,
         "given a numeric threshold collapse pixels of intensity greater than "
         "the threshold to white, and those less than to black.  Result is a "
         "two color image.  Accepts a single numeric arg from 0-256, default "
         "is 128."
     },
     {
-        "thumbnail", true, true, thumbnailTransform,
+        "thumbnail", true, true, thumbnailTransform, NULL, NULL,
         "An alternate version of 'scale' optimized for fast thumnailing, "
         "combine with a relatively high 'quality' argument (75-85) for "
         "the best balance between speed and quality.  Accepts the same "
-        "arguments as 'scale'."
+        "arguments as 'scale', including draft, though a thumbnail is "
+        "decoded no smaller than five times the result: as much detail as "
+        "thumbnailing keeps anyway."
     },
     {
-        "unsharpen", false, false, unsharpenTransform,
+        "unsharpen", false, false, unsharpenTransform, NULL, NULL,
         "unsharpen an image"
     }
 };
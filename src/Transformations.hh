@@ -7,10 +7,26 @@
 
 #include "bpservice/bpservice.h"
 #include <magick/api.h>
+#include "PointKernel.hh"
+
+/** as ThumbnailImage() does, a thumbnail less than this fraction of the
+ *  area of its image is point sampled down to THUMBNAIL_SAMPLE_FACTOR
+ *  times its size before it's filtered.  A draft thumbnail may be
+ *  decoded at that size too. */
+#define THUMBNAIL_SAMPLE_AREA 0.1
+#define THUMBNAIL_SAMPLE_FACTOR 5
 
 namespace trans {
     /** All image processing phases conform to this signature: */
     typedef Image* (*TransformationFunc)(const Image* inImage, const bplus::Object* args, int quality, std::string &oError);
+    /** Phases that can modify an image directly may also provide this
+     *  variant.  It takes ownership of a single frame image and returns
+     *  the result, which may be the same image.  On failure the image
+     *  is destroyed and NULL is returned. */
+    typedef Image* (*InPlaceTransformationFunc)(Image* image, const bplus::Object* args, int quality, std::string &oError);
+    /** Pixel-local phases can also compile themselves into a PointKernel
+     *  so that runs of them can be applied in a single pass */
+    typedef bool (*PointOperationFunc)(PointKernel& kernel, const bplus::Object* args, std::string &oError);
     typedef struct {
         // the name of the transformation (as a client would specify it)
         const char* name;
@@ -20,12 +36,34 @@ namespace trans {
         bool requiresArgs;
         // the function that actually performs work
         TransformationFunc transform;
+        // the same work done on an image we may modify (else NULL)
+        InPlaceTransformationFunc transformInPlace;
+        // for transformations which only depend on a single pixel's
+        // color, a function that adds them to a PointKernel (else NULL)
+        PointOperationFunc pointOp;
         // documentation
         const char* doc;
     } Transformation;
     unsigned int num();
     const Transformation* get(unsigned int);
     const Transformation* get(const std::string& name);
+    /** extract the arguments of the scale or thumbnail action named
+     *  funcName, maxwidth and maxheight are -1 when not specified */
+    bool scalingBounds(const char* funcName, const bplus::Object* args,
+                       int& maxwidth, int& maxheight, bool& draft,
+                       std::string& oError);
+    /** compute the size that the scale or thumbnail action named funcName
+     *  would produce from an image of inX by inY pixels.  draft is set if
+     *  the client allows a reduced quality decode. */
+    bool scalingDimensions(const char* funcName, unsigned int inX, unsigned int inY,
+                           const bplus::Object* args, unsigned int& x, unsigned int& y,
+                           bool& draft, std::string& oError);
+    /** compute the rectangle that the crop action with the given
+     *  arguments selects from an image of x by y pixels */
+    bool cropRegion(unsigned int x, unsigned int y, const bplus::Object* args,
+                    RectangleInfo& ri, std::string& oError);
+    /** extract the angle of the rotate action with the given arguments */
+    bool rotationDegrees(const bplus::Object* args, double& degrees, std::string& oError);
 };
 
 #endif
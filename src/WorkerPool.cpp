@@ -0,0 +1,120 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "WorkerPool.hh"
+#include "bpservice/bpservice.h"
+#include <boost/bind.hpp>
+#include <exception>
+#include <sstream>
+
+// the pool outlives its workers' claim on it
+static void
+notOwned(imageproc::WorkerPool*) {
+}
+
+imageproc::WorkerPool::WorkerPool(unsigned int threads, unsigned int maxInFlight)
+    : m_running(0), m_maxInFlight(maxInFlight), m_stopping(false), m_onWorker(notOwned)
+{
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (m_maxInFlight < threads) {
+        m_maxInFlight = threads;
+    }
+    for (unsigned int i = 0; i < threads; i++) {
+        m_workers.create_thread(boost::bind(&WorkerPool::run, this));
+    }
+}
+
+imageproc::WorkerPool::~WorkerPool() {
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        m_stopping = true;
+    }
+    m_jobReady.notify_all();
+    m_workers.join_all();
+}
+
+void
+imageproc::WorkerPool::submit(const Job& job) {
+    boost::mutex::scoped_lock lock(m_lock);
+    bool onWorker = (m_onWorker.get() == this);
+    while (!onWorker && m_queue.size() + m_running >= m_maxInFlight) {
+        m_jobDone.wait(lock);
+    }
+    m_queue.push_back(job);
+    m_jobReady.notify_one();
+}
+
+unsigned int
+imageproc::WorkerPool::threads() const {
+    return (unsigned int)m_workers.size();
+}
+
+unsigned int
+imageproc::WorkerPool::maxInFlight() const {
+    return m_maxInFlight;
+}
+
+void
+imageproc::WorkerPool::run() {
+    m_onWorker.reset(this);
+    boost::mutex::scoped_lock lock(m_lock);
+    for (;;) {
+        while (m_queue.empty() && !m_stopping) {
+            m_jobReady.wait(lock);
+        }
+        // drain the queue before stopping, every job carries a
+        // transaction someone is waiting on
+        if (m_queue.empty()) {
+            break;
+        }
+        Job job = m_queue.front();
+        m_queue.pop_front();
+        m_running++;
+        lock.unlock();
+        // jobs catch their own failures to answer their transactions,
+        // this just keeps the worker alive if one slips through
+        try {
+            job();
+        } catch (const std::exception& e) {
+            std::stringstream ss;
+            ss << "worker job threw: " << e.what();
+            bplus::service::Service::log(BP_ERROR, ss.str());
+        } catch (...) {
+            bplus::service::Service::log(BP_ERROR, "worker job threw");
+        }
+        lock.lock();
+        m_running--;
+        m_jobDone.notify_one();
+    }
+}
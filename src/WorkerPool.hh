@@ -0,0 +1,83 @@
+/*
+ * Copyright 2009, Yahoo!
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the name of Yahoo! nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A fixed set of worker threads fed from a bounded queue.
+ */
+
+#ifndef __WORKERPOOL_HH__
+#define __WORKERPOOL_HH__
+
+#include <deque>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+namespace imageproc {
+    class WorkerPool {
+    public:
+        /** a job must complete its own transaction, even when it fails.
+         *  One that throws is logged, but no one else answers for it. */
+        typedef boost::function<void ()> Job;
+        /** start threads workers.  At most maxInFlight jobs may be
+         *  queued or running at once, it's raised to threads if smaller. */
+        WorkerPool(unsigned int threads, unsigned int maxInFlight);
+        /** runs every job already submitted, then joins the workers */
+        ~WorkerPool();
+        /** queue job to run on a worker.  Blocks while maxInFlight jobs
+         *  are queued or running, which pushes back on the caller.  A job
+         *  running on one of the pool's workers may fan out into more
+         *  jobs: submitting from a worker never blocks, as the slot it
+         *  holds couldn't free up while it waited. */
+        void submit(const Job& job);
+        unsigned int threads() const;
+        unsigned int maxInFlight() const;
+    private:
+        void run();
+        WorkerPool(const WorkerPool&);
+        WorkerPool& operator=(const WorkerPool&);
+
+        boost::mutex m_lock;
+        // signalled when a job is queued, or on shutdown
+        boost::condition_variable m_jobReady;
+        // signalled when a job finishes
+        boost::condition_variable m_jobDone;
+        std::deque<Job> m_queue;
+        unsigned int m_running;
+        unsigned int m_maxInFlight;
+        bool m_stopping;
+        boost::thread_group m_workers;
+        // set to this pool on its workers
+        boost::thread_specific_ptr<WorkerPool> m_onWorker;
+    };
+};
+
+#endif
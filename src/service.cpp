@@ -33,15 +33,29 @@
 #include "bpservice/bpservice.h"
 #include "ImageProcessor.hh"
 #include "Transformations.hh"
+#include "WorkerPool.hh"
+#include "BandScheduler.hh"
+#include "OutputCache.hh"
+#include "SourceCache.hh"
+#include "MemoryBudget.hh"
+#include "Profile.hh"
+#include "Trace.hh"
+#include "Resample.hh"
 #include "bp-file/bpfile.h"
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <list>
 #include <sstream>
+#include <vector>
 
 // NEEDSWORK!!!  Delete this once we move to v5 and no longer need file uri's
 #include "bpurlutil.cpp"
@@ -50,6 +64,28 @@
 #define IA_DEFAULT_QUALITY 75
 #define IA_DEFAULT_QUALITY_STR "75"
 
+// the worker pool may be sized through the environment, by default
+// there's a worker per core and each may have a few jobs waiting
+#define IA_WORKERS_ENV "BP_IMAGEALTER_WORKERS"
+#define IA_MAX_IN_FLIGHT_ENV "BP_IMAGEALTER_MAX_IN_FLIGHT"
+// and the number of threads a single large image may be spread over
+#define IA_BAND_THREADS_ENV "BP_IMAGEALTER_BAND_THREADS"
+#define IA_QUEUED_PER_WORKER 4
+// setting a budget (in megabytes) for cached results turns the result
+// cache on
+#define IA_CACHE_MB_ENV "BP_IMAGEALTER_CACHE_MB"
+// and a budget for decoded inputs turns the source cache on
+#define IA_SOURCE_CACHE_MB_ENV "BP_IMAGEALTER_SOURCE_CACHE_MB"
+// a budget for the memory transforms may use at once turns admission
+// control on, transforms that don't fit wait a while before failing
+#define IA_MEMORY_MB_ENV "BP_IMAGEALTER_MEMORY_MB"
+#define IA_MEMORY_WAIT_ENV "BP_IMAGEALTER_MEMORY_WAIT"
+#define IA_MEMORY_WAIT_SECS 30
+// setting this records trace spans from startup
+#define IA_TRACE_ENV "BP_IMAGEALTER_TRACE"
+// and this resizes with our own resampler rather than GraphicsMagick's
+#define IA_NATIVE_RESIZE_ENV "BP_IMAGEALTER_NATIVE_RESIZE"
+
 class ImageAlter : public bplus::service::Service {
 public:
 BP_SERVICE(ImageAlter)
@@ -59,10 +95,30 @@ BP_SERVICE(ImageAlter)
     static bool onServiceUnload();
     virtual void finalConstruct();
     void transform(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void transformBatch(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void renditions(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void info(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void trace(const bplus::service::Transaction& tran, const bplus::Map& args);
 private:
+    bool outputArgs(const bplus::service::Transaction& tran, const bplus::Map& args,
+                    imageproc::Type& t, int& quality);
     std::string m_tempDir;
+    // shared by all sessions, transforms run here rather than on the
+    // thread that delivers the transaction
+    static imageproc::WorkerPool* s_pool;
+    // results of earlier transforms, or NULL
+    static imageproc::OutputCache* s_cache;
+    // decoded inputs of earlier transforms, or NULL
+    static imageproc::SourceCache* s_sourceCache;
+    // limits the memory transforms use at once, or NULL
+    static imageproc::MemoryBudget* s_memoryBudget;
 };
 
+imageproc::WorkerPool* ImageAlter::s_pool = NULL;
+imageproc::OutputCache* ImageAlter::s_cache = NULL;
+imageproc::SourceCache* ImageAlter::s_sourceCache = NULL;
+imageproc::MemoryBudget* ImageAlter::s_memoryBudget = NULL;
+
 BP_SERVICE_DESC(ImageAlter, "ImageAlter", "4.1.0",
                 "Implements client side Image manipulation")
 ADD_BP_METHOD(ImageAlter, transform,
@@ -86,6 +142,72 @@ ADD_BP_METHOD_ARG(transform, "actions", List, false,
                   "a single property, where the property name is the action "
                   "to perform, and the property value is the argument (i.e. "
                   "{ actions: [{rotate: 90}] }.  Supported actions include: ")
+ADD_BP_METHOD_ARG(transform, "animated", Boolean, false,
+                  "When true, every frame of an animated image is "
+                  "transformed, and the result stays animated if the output "
+                  "format allows it.  By default only the first frame is "
+                  "kept.")
+ADD_BP_METHOD_ARG(transform, "profile", Boolean, false,
+                  "When true, the result has a profile property breaking "
+                  "down where the time went: stages, a list of objects with "
+                  "name and ms properties in the order they ran (read, "
+                  "decode, each action, write and so on), along with "
+                  "bytesIn and bytesOut (the sizes of the input and output "
+                  "files) and peakPixelBytes (the most memory held in "
+                  "pixels at once).")
+ADD_BP_METHOD(ImageAlter, transformBatch,
+              "Perform the same set of transformations on many images.  "
+              "Returns a list with an entry for each input file, in order.  "
+              "Entries are either what transform would return for the file, "
+              "or an object with error and verboseError properties.")
+ADD_BP_METHOD_ARG(transformBatch, "files", List, true,
+                  "The images to transform.")
+ADD_BP_METHOD_ARG(transformBatch, "format", String, false,
+                  "The format of the output images, as for transform.")
+ADD_BP_METHOD_ARG(transformBatch, "quality", Integer, false,
+                  "The quality of the output images, as for transform (default: "
+                  IA_DEFAULT_QUALITY_STR ")")
+ADD_BP_METHOD_ARG(transformBatch, "actions", List, false,
+                  "An array of actions to perform on every image, as for "
+                  "transform.")
+ADD_BP_METHOD_ARG(transformBatch, "animated", Boolean, false,
+                  "Whether to transform every frame of animated images, as "
+                  "for transform.")
+ADD_BP_METHOD(ImageAlter, renditions,
+              "Make several versions of an image (say, a thumbnail and a "
+              "couple of larger sizes) from a single read of it.  Returns an "
+              "object with a property for each rendition, holding either what "
+              "transform would return, or an object with error and "
+              "verboseError properties.")
+ADD_BP_METHOD_ARG(renditions, "file", Path, true,
+                  "The image to transform.")
+ADD_BP_METHOD_ARG(renditions, "actions", List, false,
+                  "Actions to perform once, before making any rendition.")
+ADD_BP_METHOD_ARG(renditions, "renditions", Map, true,
+                  "The renditions to make.  Each property names a rendition, "
+                  "its value is an object with optional actions, format and "
+                  "quality properties, as for transform.  Renditions which begin "
+                  "by scaling the image down are made from one another, largest "
+                  "first.")
+ADD_BP_METHOD(ImageAlter, info,
+              "Describe an image without decoding it, from its headers alone.  "
+              "Returns an object with format, width, height, frames, colorType "
+              "(rgb, gray, palette or cmyk, with an 'a' appended if there's an "
+              "alpha channel), depth (bits per sample) and hasOrientation "
+              "properties, and orientation (the EXIF orientation, 1-8) when "
+              "hasOrientation is true.")
+ADD_BP_METHOD_ARG(info, "file", Path, true,
+                  "The image to describe.")
+ADD_BP_METHOD(ImageAlter, trace,
+              "Write the recently recorded trace spans (reading, decoding, "
+              "each action, writing and so on, per thread) to a file of "
+              "Chrome trace_event JSON, viewable in chrome://tracing.  "
+              "Returns an object with a file property.  Recording is off "
+              "unless turned on here or by the BP_IMAGEALTER_TRACE "
+              "environment variable.")
+ADD_BP_METHOD_ARG(trace, "enable", Boolean, false,
+                  "Turn recording on or off, after writing what has been "
+                  "recorded so far.")
 #if 0
         // add all actions
         for (unsigned int i = 0; i < trans::num(); i++) {
@@ -95,6 +217,289 @@ ADD_BP_METHOD_ARG(transform, "actions", List, false,
 #endif // 0
 END_BP_SERVICE_DESC
 
+// a positive number from the environment variable name, or def
+static unsigned int
+envNumber(const char* name, unsigned int def) {
+    const char* v = getenv(name);
+    if (v != NULL) {
+        int n = atoi(v);
+        if (n > 0) {
+            return (unsigned int)n;
+        }
+    }
+    return def;
+}
+
+// the result transform() returns for a successful transformation
+static bplus::Map*
+resultMap(const std::string& rez, unsigned int x, unsigned int y,
+          unsigned int orig_x, unsigned int orig_y) {
+    bplus::Map* m = new bplus::Map;
+    m->add("file", new bplus::Path(rez));
+    m->add("width", new bplus::Integer(x));
+    m->add("height", new bplus::Integer(y));
+    m->add("orig_width", new bplus::Integer(orig_x));
+    m->add("orig_height", new bplus::Integer(orig_y));
+    return m;
+}
+
+// the profile property of a transform() result
+static bplus::Map*
+profileMap(const imageproc::Profile& profile) {
+    bplus::Map* m = new bplus::Map;
+    bplus::List* stages = new bplus::List;
+    for (unsigned int i = 0; i < profile.stages.size(); i++) {
+        bplus::Map* s = new bplus::Map;
+        s->add("name", new bplus::String(profile.stages[i].name));
+        s->add("ms", new bplus::Double(profile.stages[i].millis));
+        stages->append(s);
+    }
+    m->add("stages", stages);
+    m->add("bytesIn", new bplus::Integer(profile.bytesIn));
+    m->add("bytesOut", new bplus::Integer(profile.bytesOut));
+    m->add("peakPixelBytes", new bplus::Integer(profile.peakPixelBytes));
+    return m;
+}
+
+// a job that throws must still answer its transaction, or the client
+// waits on it forever
+static void
+jobThrew(const bplus::service::Transaction& tran, const char* what) {
+    std::stringstream ss;
+    ss << "transform threw: " << what;
+    bplus::service::Service::log(BP_ERROR, ss.str());
+    tran.error("bp.transformFailed", what);
+}
+
+// hand a job to the pool.  One that can't be queued won't answer its
+// transaction, so it's answered here.
+static void
+submitJob(imageproc::WorkerPool* pool, const bplus::service::Transaction& tran,
+          const imageproc::WorkerPool::Job& job) {
+    std::string err;
+    try {
+        pool->submit(job);
+        return;
+    } catch (const std::exception& e) {
+        err = e.what();
+    } catch (...) {
+        err = "unknown";
+    }
+    std::stringstream ss;
+    ss << "couldn't queue transform: " << err;
+    bplus::service::Service::log(BP_ERROR, ss.str());
+    tran.error("bp.transformFailed", err.c_str());
+}
+
+// perform the transformation on a worker thread and complete the
+// transaction.  actions is a private copy of the client's list, the
+// original goes away when transform() returns.
+static void
+transformImage(const bplus::service::Transaction tran,
+             const std::string path,
+             const std::string tempDir,
+             imageproc::Type t,
+             boost::shared_ptr<bplus::Object> actions,
+             int quality,
+             bool allFrames,
+             bool wantProfile) {
+    std::stringstream ss;
+    std::string err;
+    unsigned int x;
+    unsigned int y;
+    unsigned int orig_x;
+    unsigned int orig_y;
+    imageproc::Profile profile;
+    std::string rez = imageproc::ChangeImage(path, tempDir, t, *((const bplus::List*)actions.get()),
+                                             quality, x, y, orig_x, orig_y, err, allFrames,
+                                             wantProfile ? &profile : NULL);
+    if (rez.empty()) {
+        if (err.empty()) {
+            err.append("unknown");
+        }
+        // error!
+        ss.str("");
+        ss << "couldn't transform image: " << err;
+        bplus::service::Service::log(BP_ERROR, ss.str());
+        tran.error("bp.transformFailed", err.c_str());
+    }
+    else {
+        // success!
+        boost::scoped_ptr<bplus::Map> m(resultMap(rez, x, y, orig_x, orig_y));
+        if (wantProfile) {
+            m->add("profile", profileMap(profile));
+        }
+        tran.complete(*m);
+    }
+}
+
+static void
+runTransform(const bplus::service::Transaction tran,
+             const std::string path,
+             const std::string tempDir,
+             imageproc::Type t,
+             boost::shared_ptr<bplus::Object> actions,
+             int quality,
+             bool allFrames,
+             bool wantProfile) {
+    try {
+        transformImage(tran, path, tempDir, t, actions, quality, allFrames, wantProfile);
+    } catch (const std::exception& e) {
+        jobThrew(tran, e.what());
+    } catch (...) {
+        jobThrew(tran, "unknown");
+    }
+}
+
+// what the images of a transformBatch() call share.  The transaction
+// is completed by whichever image finishes last.
+struct Batch {
+    Batch(const bplus::service::Transaction& t) : tran(t), remaining(0), queued(0) { }
+    ~Batch() {
+        for (unsigned int i = 0; i < results.size(); i++) {
+            delete results[i];
+        }
+    }
+    bplus::service::Transaction tran;
+    std::string tempDir;
+    imageproc::Type type;
+    int quality;
+    bool allFrames;
+    // validated once for all images.  args point into actionArgs.
+    boost::shared_ptr<bplus::Object> actionArgs;
+    trans::ActionList actions;
+    // empty where the client's file URI was invalid
+    std::vector<std::string> paths;
+    boost::mutex lock;
+    unsigned int remaining;
+    // images handed to the pool and not yet finished
+    unsigned int queued;
+    std::vector<bplus::Object*> results;
+};
+
+// count off one piece of a batch, completing the transaction after the
+// last.  batch->lock must be held.
+static void
+batchDone(Batch& batch) {
+    if (--batch.remaining > 0) {
+        return;
+    }
+    bplus::List l;
+    for (unsigned int i = 0; i < batch.results.size(); i++) {
+        l.append(batch.results[i]);
+        batch.results[i] = NULL;
+    }
+    batch.tran.complete(l);
+}
+
+// record the result of the i'th image of a batch.  Takes ownership of
+// result.
+static void
+batchResult(boost::shared_ptr<Batch> batch, unsigned int i, bplus::Object* result) {
+    boost::mutex::scoped_lock lock(batch->lock);
+    batch->results[i] = result;
+    batchDone(*batch);
+}
+
+static bplus::Object*
+batchError(const char* error, const std::string& verboseError) {
+    bplus::Map* m = new bplus::Map;
+    m->add("error", new bplus::String(error));
+    m->add("verboseError", new bplus::String(verboseError));
+    return m;
+}
+
+static void
+transformBatchImage(boost::shared_ptr<Batch> batch, unsigned int i, const std::string& path) {
+    std::stringstream ss;
+    std::string err;
+    unsigned int x;
+    unsigned int y;
+    unsigned int orig_x;
+    unsigned int orig_y;
+    std::string rez = imageproc::ChangeImage(path, batch->tempDir, batch->type, batch->actions,
+                                             batch->quality, x, y, orig_x, orig_y, err,
+                                             batch->allFrames);
+    if (rez.empty()) {
+        if (err.empty()) {
+            err.append("unknown");
+        }
+        ss << "couldn't transform image " << i << ": " << err;
+        bplus::service::Service::log(BP_ERROR, ss.str());
+        batchResult(batch, i, batchError("bp.transformFailed", err));
+    } else {
+        batchResult(batch, i, resultMap(rez, x, y, orig_x, orig_y));
+    }
+}
+
+// an image that throws is reported as failed, so the batch still
+// completes
+static void
+runBatchTransform(boost::shared_ptr<Batch> batch, unsigned int i, const std::string path) {
+    std::string err;
+    try {
+        transformBatchImage(batch, i, path);
+        return;
+    } catch (const std::exception& e) {
+        err = e.what();
+    } catch (...) {
+        err = "unknown";
+    }
+    std::stringstream ss;
+    ss << "transform of image " << i << " threw: " << err;
+    bplus::service::Service::log(BP_ERROR, ss.str());
+    batchResult(batch, i, batchError("bp.transformFailed", err));
+}
+
+static void
+runQueuedBatchTransform(boost::shared_ptr<Batch> batch, unsigned int i, const std::string path) {
+    runBatchTransform(batch, i, path);
+    boost::mutex::scoped_lock lock(batch->lock);
+    batch->queued--;
+}
+
+// hand out the images of a batch from a worker, one job each.  Being on
+// a worker, queueing them never blocks, so the batch queues no more
+// than the pool would let in at once, less the place it holds itself.
+// Past that it transforms the next image here instead: waiting for its
+// own images to finish could wait forever on a pool of one thread.
+static void
+runBatch(boost::shared_ptr<Batch> batch, imageproc::WorkerPool* pool) {
+    unsigned int maxQueued = pool->maxInFlight() - 1;
+    for (unsigned int i = 0; i < batch->paths.size(); i++) {
+        if (batch->paths[i].empty()) {
+            batchResult(batch, i, batchError("bp.fileAccessError", "invalid file URI"));
+            continue;
+        }
+        bool queue = false;
+        {
+            boost::mutex::scoped_lock lock(batch->lock);
+            if (batch->queued < maxQueued) {
+                batch->queued++;
+                queue = true;
+            }
+        }
+        if (!queue) {
+            runBatchTransform(batch, i, batch->paths[i]);
+            continue;
+        }
+        // failing to queue an image mustn't leave the batch unfinished
+        try {
+            pool->submit(boost::bind(&runQueuedBatchTransform, batch, i, batch->paths[i]));
+        } catch (const std::exception& e) {
+            {
+                boost::mutex::scoped_lock lock(batch->lock);
+                batch->queued--;
+            }
+            batchResult(batch, i, batchError("bp.transformFailed", e.what()));
+        }
+    }
+    // an empty list, or one where every image has already finished,
+    // completes here
+    boost::mutex::scoped_lock lock(batch->lock);
+    batchDone(*batch);
+}
+
 ImageAlter::ImageAlter() {
 }
 
@@ -103,13 +508,72 @@ ImageAlter::~ImageAlter() {
 
 bool
 ImageAlter::onServiceLoad() {
+    // tracing first, so it sees the engine's startup banner
+    if (envNumber(IA_TRACE_ENV, 0) > 0) {
+        imageproc::trace::enable(true);
+        log(BP_INFO, "tracing enabled");
+    }
     // initialize the GraphicsMagick engine.  vroom.
     imageproc::init();
+    unsigned int workers = envNumber(IA_WORKERS_ENV, boost::thread::hardware_concurrency());
+    if (workers < 1) {
+        workers = 1;
+    }
+    unsigned int maxInFlight = envNumber(IA_MAX_IN_FLIGHT_ENV, workers * IA_QUEUED_PER_WORKER);
+    s_pool = new imageproc::WorkerPool(workers, maxInFlight);
+    imageproc::SetBandConcurrency(envNumber(IA_BAND_THREADS_ENV, 0));
+    std::stringstream ss;
+    unsigned int cacheMB = envNumber(IA_CACHE_MB_ENV, 0);
+    if (cacheMB > 0) {
+        boost::filesystem::path dir = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("ImageAlterCache-%%%%-%%%%-%%%%");
+        s_cache = new imageproc::OutputCache(dir, (boost::uintmax_t)cacheMB * 1024 * 1024);
+        imageproc::SetOutputCache(s_cache);
+        ss << "caching up to " << cacheMB << "MB of results in " << dir.string();
+        log(BP_INFO, ss.str());
+        ss.str("");
+    }
+    unsigned int sourceCacheMB = envNumber(IA_SOURCE_CACHE_MB_ENV, 0);
+    if (sourceCacheMB > 0) {
+        s_sourceCache = new imageproc::SourceCache((boost::uintmax_t)sourceCacheMB * 1024 * 1024);
+        imageproc::SetSourceCache(s_sourceCache);
+        ss << "caching up to " << sourceCacheMB << "MB of decoded images";
+        log(BP_INFO, ss.str());
+        ss.str("");
+    }
+    if (envNumber(IA_NATIVE_RESIZE_ENV, 0) > 0) {
+        trans::useNativeResampler(true);
+        log(BP_INFO, "resizing with the native resampler");
+    }
+    unsigned int memoryMB = envNumber(IA_MEMORY_MB_ENV, 0);
+    if (memoryMB > 0) {
+        unsigned int wait = envNumber(IA_MEMORY_WAIT_ENV, IA_MEMORY_WAIT_SECS);
+        s_memoryBudget = new imageproc::MemoryBudget((boost::uintmax_t)memoryMB * 1024 * 1024, wait);
+        imageproc::SetMemoryBudget(s_memoryBudget);
+        ss << "transforms limited to " << memoryMB << "MB, waiting up to " << wait << "s for memory";
+        log(BP_INFO, ss.str());
+        ss.str("");
+    }
+    ss << "started " << s_pool->threads() << " workers, at most "
+       << s_pool->maxInFlight() << " transforms in flight";
+    log(BP_INFO, ss.str());
     return true;
 }
 
 bool
 ImageAlter::onServiceUnload() {
+    // finish outstanding transforms before the engine goes away
+    delete s_pool;
+    s_pool = NULL;
+    imageproc::SetOutputCache(NULL);
+    delete s_cache;
+    s_cache = NULL;
+    imageproc::SetSourceCache(NULL);
+    delete s_sourceCache;
+    s_sourceCache = NULL;
+    imageproc::SetMemoryBudget(NULL);
+    delete s_memoryBudget;
+    s_memoryBudget = NULL;
     // shutdown the GraphicsMagick engine.  vroom.
     imageproc::shutdown();
     return true;
@@ -120,15 +584,35 @@ ImageAlter::finalConstruct() {
     // extract the temporary directory
     m_tempDir = context("temp_dir");
     boost::filesystem::create_directory(m_tempDir);
-    std::stringstream ss;
-    ss << "session allocated, using temp dir: " << (m_tempDir.empty() ? "<empty>" : m_tempDir);
-    log(BP_INFO, ss.str());
+    IA_LOG(BP_INFO, "session allocated, using temp dir: " << (m_tempDir.empty() ? "<empty>" : m_tempDir));
+}
+
+// extract the output format and quality arguments.  On failure the
+// transaction is failed and false returned.
+bool
+ImageAlter::outputArgs(const bplus::service::Transaction& tran, const bplus::Map& args,
+                       imageproc::Type& t, int& quality) {
+    // now let's figure out the output format
+    t = imageproc::UNKNOWN;
+    if (args.has("format")) {
+        t = imageproc::pathToType(*(args.get("format")));
+        if (t == imageproc::UNKNOWN) {
+            log(BP_ERROR, "can't determine output format");
+            tran.error("bp.invalidArguments", "can't determine output format");
+            return false;
+        }
+    }
+    // extract quality argument
+    quality = IA_DEFAULT_QUALITY;
+    if (args.has("quality", BPTInteger)) {
+        quality = (int)(long long)*((const bplus::Integer*)(args.get("quality")));
+    }
+    return true;
 }
 
 void
 ImageAlter::transform(const bplus::service::Transaction& tran, const bplus::Map& args) {
     std::stringstream ss;
-    // XXX: we need to get a little thready here
     // first we'll get the input file into a string
     const bplus::Path* bpPath = dynamic_cast<const bplus::Path*>(args.value("file"));
 // NEEDSWORK!!!  Fix this when port to v5 since we don't need URI's anymore
@@ -144,51 +628,253 @@ ImageAlter::transform(const bplus::service::Transaction& tran, const bplus::Map&
         tran.error("bp.fileAccessError", "invalid file URI");
         return;
     }
-    // now let's figure out the output format
-    imageproc::Type t = imageproc::UNKNOWN;
-    if (args.has("format")) {
-        t = imageproc::pathToType(*(args.get("format")));
-        if (t == imageproc::UNKNOWN) {
-            log(BP_ERROR, "can't determine output format");
-            tran.error("bp.invalidArguments", "can't determine output format");
-            return;
-        }
-    }
-    // extract quality argument
-    int quality = IA_DEFAULT_QUALITY;
-    if (args.has("quality", BPTInteger)) {
-        quality = (int)(long long)*((const bplus::Integer*)(args.get("quality")));
+    // now the output format and quality
+    imageproc::Type t;
+    int quality;
+    if (!outputArgs(tran, args, t, quality)) {
+        return;
     }
     // finally, let's pull out the list of transformation actions
-    bplus::List emptyList;
-    bplus::List* lPtr = &emptyList;
+    boost::shared_ptr<bplus::Object> actions;
     if (args.has("actions")) {
-        lPtr = (bplus::List *) args.get("actions");
+        actions.reset(args.get("actions")->clone());
+    } else {
+        actions.reset(new bplus::List);
     }
+    bool allFrames = args.has("animated", BPTBoolean) && (bool)*(args.get("animated"));
+    bool wantProfile = args.has("profile", BPTBoolean) && (bool)*(args.get("profile"));
+    // hand the work to the pool, this blocks while the pool is full
+    submitJob(s_pool, tran, boost::bind(&runTransform, tran, path, m_tempDir, t, actions, quality,
+                                        allFrames, wantProfile));
+}
+
+// what a renditions() call needs on the worker thread
+struct RenditionsJob {
+    RenditionsJob(const bplus::service::Transaction& t) : tran(t) { }
+    bplus::service::Transaction tran;
+    std::string path;
+    std::string tempDir;
+    // actions point into args
+    boost::shared_ptr<bplus::Object> args;
+    trans::ActionList prefix;
+    std::vector<imageproc::Rendition> renditions;
+};
+
+static void
+makeRenditions(boost::shared_ptr<RenditionsJob> job) {
     std::string err;
-    unsigned int x;
-    unsigned int y;
-    unsigned int orig_x;
-    unsigned int orig_y;
-    std::string rez = imageproc::ChangeImage(path, m_tempDir, t, *lPtr, quality, x, y, orig_x, orig_y, err);
-    if (rez.empty()) {
+    if (!imageproc::MakeRenditions(job->path, job->tempDir, job->prefix, job->renditions, err)) {
         if (err.empty()) {
             err.append("unknown");
         }
-        // error!
-        ss.str("");
-        ss << "couldn't transform image: " << err;
+        std::stringstream ss;
+        ss << "couldn't make renditions: " << err;
+        bplus::service::Service::log(BP_ERROR, ss.str());
+        job->tran.error("bp.transformFailed", err.c_str());
+        return;
+    }
+    bplus::Map m;
+    for (unsigned int i = 0; i < job->renditions.size(); i++) {
+        const imageproc::Rendition& r = job->renditions[i];
+        if (r.path.empty()) {
+            m.add(r.name.c_str(), batchError("bp.transformFailed", r.error.empty() ? "unknown" : r.error));
+        } else {
+            m.add(r.name.c_str(), resultMap(r.path, r.x, r.y, r.orig_x, r.orig_y));
+        }
+    }
+    job->tran.complete(m);
+}
+
+static void
+runRenditions(boost::shared_ptr<RenditionsJob> job) {
+    try {
+        makeRenditions(job);
+    } catch (const std::exception& e) {
+        jobThrew(job->tran, e.what());
+    } catch (...) {
+        jobThrew(job->tran, "unknown");
+    }
+}
+
+void
+ImageAlter::transformBatch(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    std::stringstream ss;
+    boost::shared_ptr<Batch> batch(new Batch(tran));
+    batch->tempDir = m_tempDir;
+    if (!outputArgs(tran, args, batch->type, batch->quality)) {
+        return;
+    }
+    batch->allFrames = args.has("animated", BPTBoolean) && (bool)*(args.get("animated"));
+    // validate the actions once, for all images
+    if (args.has("actions")) {
+        batch->actionArgs.reset(args.get("actions")->clone());
+    } else {
+        batch->actionArgs.reset(new bplus::List);
+    }
+    std::string err;
+    if (!trans::parseActions(*((const bplus::List*)batch->actionArgs.get()), batch->actions, err)) {
+        ss << "couldn't transform images: " << err;
         log(BP_ERROR, ss.str());
         tran.error("bp.transformFailed", err.c_str());
+        return;
     }
-    else {
-        // success!
-        bplus::Map m;
-        m.add("file", new bplus::Path(rez));
-        m.add("width", new bplus::Integer(x));
-        m.add("height", new bplus::Integer(y));
-        m.add("orig_width", new bplus::Integer(orig_x));
-        m.add("orig_height", new bplus::Integer(orig_y));
-        tran.complete(m);
+    trans::optimizeActions(batch->actions);
+    const bplus::List* files = (const bplus::List*)args.get("files");
+    batch->results.resize(files->size(), NULL);
+    batch->paths.resize(files->size());
+    // no image can finish the batch until they've all been handed out
+    batch->remaining = files->size() + 1;
+    IA_LOG(BP_INFO, "transforming " << files->size() << " images with "
+                    << batch->actions.size() << " actions");
+    for (unsigned int i = 0; i < files->size(); i++) {
+        const bplus::Object* f = files->value(i);
+        std::string path;
+        if (f->type() == BPTPath) {
+// NEEDSWORK!!!  Fix this when port to v5 since we don't need URI's anymore
+#if 0
+            path = (std::string)(*f);
+#else // 0
+            path = bp::urlutil::pathFromURL((std::string)(*f));
+#endif // 0
+        }
+        batch->paths[i] = path;
+    }
+    // the batch takes a single place in the queue however many images
+    // it has, so it holds up the caller no longer than a transform
+    submitJob(s_pool, tran, boost::bind(&runBatch, batch, s_pool));
+}
+
+void
+ImageAlter::renditions(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    std::stringstream ss;
+    boost::shared_ptr<RenditionsJob> job(new RenditionsJob(tran));
+    job->tempDir = m_tempDir;
+    const bplus::Path* bpPath = dynamic_cast<const bplus::Path*>(args.value("file"));
+// NEEDSWORK!!!  Fix this when port to v5 since we don't need URI's anymore
+#if 0
+    job->path = bpPath;
+#else // 0
+    job->path = bp::urlutil::pathFromURL((std::string)(*bpPath));
+#endif // 0
+    if (job->path.empty()) {
+        ss << "can't parse file:// url: " << (std::string)(*bpPath);
+        log(BP_ERROR, ss.str());
+        tran.error("bp.fileAccessError", "invalid file URI");
+        return;
+    }
+    // keep a copy of the arguments the actions refer to, and validate
+    // everything before doing any work
+    job->args.reset(args.clone());
+    const bplus::Map* a = (const bplus::Map*)job->args.get();
+    std::string err;
+    if (a->has("actions", BPTList) &&
+        !trans::parseActions(*((const bplus::List*)a->get("actions")), job->prefix, err)) {
+        tran.error("bp.invalidArguments", err.c_str());
+        return;
+    }
+    trans::optimizeActions(job->prefix);
+    const bplus::Map* renditions = (const bplus::Map*)a->get("renditions");
+    bplus::Map::Iterator it(*renditions);
+    const char* name;
+    while (NULL != (name = it.nextKey())) {
+        const bplus::Object* o = renditions->get(name);
+        imageproc::Rendition r;
+        r.name = name;
+        r.outputFormat = imageproc::UNKNOWN;
+        r.quality = IA_DEFAULT_QUALITY;
+        if (o->type() != BPTMap) {
+            ss << "rendition '" << name << "' must be an object";
+            tran.error("bp.invalidArguments", ss.str().c_str());
+            return;
+        }
+        if (o->has("format")) {
+            r.outputFormat = imageproc::pathToType(*(o->get("format")));
+            if (r.outputFormat == imageproc::UNKNOWN) {
+                ss << "can't determine output format of rendition '" << name << "'";
+                tran.error("bp.invalidArguments", ss.str().c_str());
+                return;
+            }
+        }
+        if (o->has("quality", BPTInteger)) {
+            r.quality = (int)(long long)*(o->get("quality"));
+        }
+        if (o->has("actions")) {
+            if (!o->has("actions", BPTList) ||
+                !trans::parseActions(*((const bplus::List*)o->get("actions")), r.actions, err)) {
+                ss << "rendition '" << name << "': " << (err.empty() ? "actions must be a list" : err);
+                tran.error("bp.invalidArguments", ss.str().c_str());
+                return;
+            }
+            trans::optimizeActions(r.actions);
+        }
+        job->renditions.push_back(r);
+    }
+    IA_LOG(BP_INFO, "making " << job->renditions.size() << " renditions of " << job->path);
+    // this blocks while the pool is full
+    submitJob(s_pool, tran, boost::bind(&runRenditions, job));
+}
+
+void
+ImageAlter::info(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    std::stringstream ss;
+    const bplus::Path* bpPath = dynamic_cast<const bplus::Path*>(args.value("file"));
+// NEEDSWORK!!!  Fix this when port to v5 since we don't need URI's anymore
+#if 0
+    std::string path = bpPath;
+#else // 0
+    std::string path = bp::urlutil::pathFromURL((std::string)(*bpPath));
+#endif // 0
+    if (path.empty()) {
+        ss << "can't parse file:// url: " << (std::string)(*bpPath);
+        log(BP_ERROR, ss.str());
+        tran.error("bp.fileAccessError", "invalid file URI");
+        return;
+    }
+    // reading headers is quick, so this runs here rather than queueing
+    // behind transforms in the pool
+    imageproc::Info info;
+    std::string err;
+    if (!imageproc::GetInfo(path, info, err)) {
+        ss << "couldn't describe image: " << err;
+        log(BP_ERROR, ss.str());
+        tran.error("bp.infoFailed", err.c_str());
+        return;
+    }
+    bplus::Map m;
+    m.add("format", new bplus::String(info.format));
+    m.add("width", new bplus::Integer(info.width));
+    m.add("height", new bplus::Integer(info.height));
+    m.add("frames", new bplus::Integer(info.frames));
+    m.add("colorType", new bplus::String(info.colorType));
+    m.add("depth", new bplus::Integer(info.depth));
+    m.add("hasOrientation", new bplus::Bool(info.orientation != 0));
+    if (info.orientation != 0) {
+        m.add("orientation", new bplus::Integer(info.orientation));
+    }
+    tran.complete(m);
+}
+
+void
+ImageAlter::trace(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    std::stringstream ss;
+    if (!boost::filesystem::is_directory(m_tempDir) && !boost::filesystem::create_directory(m_tempDir)) {
+        tran.error("bp.traceFailed", "couldn't create temp dir");
+        return;
+    }
+    boost::filesystem::path path = bp::file::getTempPath(m_tempDir, "trace.json");
+    std::ofstream ofs;
+    if (!bp::file::openWritableStream(ofs, path, std::ios_base::out | std::ios_base::binary)) {
+        ss << "Couldn't open '" << path.string() << "' for writing!";
+        log(BP_ERROR, ss.str());
+        tran.error("bp.traceFailed", "couldn't write trace");
+        return;
+    }
+    ofs << imageproc::trace::toJson();
+    ofs.close();
+    if (args.has("enable", BPTBoolean)) {
+        imageproc::trace::enable((bool)*(args.get("enable")));
     }
+    bplus::Map m;
+    m.add("file", new bplus::Path(path.string()));
+    tran.complete(m);
 }
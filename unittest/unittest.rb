@@ -6,21 +6,203 @@ require 'uri'
 require 'test/unit'
 require 'open-uri'
 require 'rbconfig'
+require 'zlib'
 include Config
 
-def runTest_private(s, f, myself)
+# the argument naming the test file name
+def testFile(name)
+  "path:" + File.expand_path(File.join(File.dirname(__FILE__), "test_files", name))
+end
+
+# transform the case in f, returning the bytes of the result
+def runCase_private(s, f)
   json = JSON.parse(File.read(f))
-  json["file"] = "path:" + File.expand_path(File.join(File.dirname(__FILE__), "test_files", json["file"]))
+  json["file"] = testFile(json["file"])
   r = s.transform(json)
+  File.open(r['file'], "rb") { |oi| oi.read }
+end
+
+# transform the case in f and compare the result with its .out file, or
+# with that of the case named golden, which it must match
+def runTest_private(s, f, myself, golden = nil)
+  got = runCase_private(s, f)
   assert_nothing_raised {
-    wantImgPath = File.join(File.dirname(f), File.basename(f, ".json") + ".out")
+    wantImgPath = File.join(File.dirname(f), (golden || File.basename(f, ".json")) + ".out")
     raise "no output file for test!" if !File.exist? wantImgPath
     want = File.open(wantImgPath, "rb") { |oi| oi.read }
-    got = File.open(r['file'], "rb") { |oi| oi.read }
     raise "output mismatch" if got != want
   }
 end
 
+# the number of frames in a GIF, counted by walking its blocks
+def gifFrames(data)
+  raise "not a GIF" if data[0, 3] != "GIF"
+  pos = 13
+  flags = data.getbyte(10)
+  pos += 3 * (2 << (flags & 7)) if flags & 0x80 != 0
+  frames = 0
+  loop do
+    case data.getbyte(pos)
+    when 0x21
+      pos += 2
+    when 0x2C
+      frames += 1
+      flags = data.getbyte(pos + 9)
+      pos += 10
+      pos += 3 * (2 << (flags & 7)) if flags & 0x80 != 0
+      pos += 1
+    when 0x3B
+      return frames
+    else
+      raise "corrupt GIF"
+    end
+    # skip the data sub-blocks
+    while (len = data.getbyte(pos)) != 0
+      pos += len + 1
+    end
+    pos += 1
+  end
+end
+
+# the width, height and number of components of a JPEG, from its frame
+# header
+def jpegInfo(data)
+  raise "not a JPEG" if data.getbyte(0) != 0xFF || data.getbyte(1) != 0xD8
+  pos = 2
+  loop do
+    raise "corrupt JPEG" if data.getbyte(pos) != 0xFF
+    marker = data.getbyte(pos + 1)
+    len = data[pos + 2, 2].unpack("n")[0]
+    if marker >= 0xC0 && marker <= 0xCF && ![0xC4, 0xC8, 0xCC].include?(marker)
+      h, w, c = data[pos + 5, 5].unpack("nnC")
+      return [w, h, c]
+    end
+    pos += 2 + len
+  end
+end
+
+# the color type of a PNG, from its header: 0 is gray, 2 RGB, 3 palette,
+# 4 gray with alpha and 6 RGB with alpha
+def pngColorType(data)
+  raise "not a PNG" if data[1, 3] != "PNG" || data[12, 4] != "IHDR"
+  data.getbyte(25)
+end
+
+# a sample of a PNG row: 16 bit samples are cut to their high byte
+def pngSample(line, n, depth)
+  return line[n * 2] if depth == 16
+  return line[n] if depth == 8
+  bit = n * depth
+  (line[bit / 8] >> (8 - depth - bit % 8)) & ((1 << depth) - 1)
+end
+
+# the width and height of a PNG and its pixels as a flat list of 8 bit
+# red, green and blue samples.  Alpha is ignored, interlacing isn't
+# supported.
+def pngPixels(data)
+  raise "not a PNG" if data[1, 3] != "PNG"
+  pos = 8
+  idat = "".b
+  palette = nil
+  w = h = depth = type = nil
+  while pos < data.size
+    len, kind = data[pos, 8].unpack("Na4")
+    body = data[pos + 8, len]
+    case kind
+    when "IHDR"
+      w, h, depth, type, _, _, interlace = body.unpack("NNCCCCC")
+      raise "interlaced PNG" if interlace != 0
+    when "PLTE"
+      palette = body.unpack("C*")
+    when "IDAT"
+      idat << body
+    end
+    pos += 12 + len
+  end
+  channels = { 0 => 1, 2 => 3, 3 => 1, 4 => 2, 6 => 4 }[type]
+  stride = (w * channels * depth + 7) / 8
+  bpp = [1, channels * depth / 8].max
+  raw = Zlib::Inflate.inflate(idat).unpack("C*")
+  prev = Array.new(stride, 0)
+  rgb = []
+  h.times do |y|
+    filter = raw[y * (stride + 1)]
+    line = raw[y * (stride + 1) + 1, stride]
+    stride.times do |i|
+      a = i >= bpp ? line[i - bpp] : 0
+      b = prev[i]
+      c = i >= bpp ? prev[i - bpp] : 0
+      pred = case filter
+             when 0 then 0
+             when 1 then a
+             when 2 then b
+             when 3 then (a + b) / 2
+             when 4
+               p = a + b - c
+               pa, pb, pc = (p - a).abs, (p - b).abs, (p - c).abs
+               pa <= pb && pa <= pc ? a : (pb <= pc ? b : c)
+             end
+      line[i] = (line[i] + pred) & 0xFF
+    end
+    w.times do |x|
+      case type
+      when 3
+        rgb.concat(palette[pngSample(line, x, depth) * 3, 3])
+      when 0, 4
+        g = pngSample(line, x * channels, depth)
+        g = g * 255 / ((1 << depth) - 1) if depth < 8
+        rgb.concat([g, g, g])
+      else
+        rgb.concat((0...3).map { |ch| pngSample(line, x * channels + ch, depth) })
+      end
+    end
+    prev = line
+  end
+  [w, h, rgb]
+end
+
+# the size scale or thumbnail gives an image of w by h pixels, truncated
+# as the service does.  A bound of nil is unconstrained.
+def scaledSize(w, h, maxwidth, maxheight)
+  if maxwidth && w > maxwidth
+    scale = maxwidth.to_f / w
+    w, h = (w * scale).to_i, (h * scale).to_i
+  end
+  if maxheight && h > maxheight
+    scale = maxheight.to_f / h
+    w, h = (w * scale).to_i, (h * scale).to_i
+  end
+  [w, h]
+end
+
+# the size of two PNGs, which must match, and the mean and largest
+# difference between their samples
+def pngDifference(a, b)
+  wa, ha, pa = pngPixels(a)
+  wb, hb, pb = pngPixels(b)
+  raise "sizes differ" if [wa, ha] != [wb, hb]
+  total = 0
+  worst = 0
+  pa.each_index do |i|
+    d = (pa[i] - pb[i]).abs
+    total += d
+    worst = d if d > worst
+  end
+  [wa, ha, total.to_f / pa.size, worst]
+end
+
+# run the block with the native resampler doing the resizing in the
+# services it starts
+def withNativeResize
+  saved = ENV['BP_IMAGEALTER_NATIVE_RESIZE']
+  ENV['BP_IMAGEALTER_NATIVE_RESIZE'] = '1'
+  begin
+    yield
+  ensure
+    ENV['BP_IMAGEALTER_NATIVE_RESIZE'] = saved
+  end
+end
+
 class TestImageAlter < Test::Unit::TestCase
   def setup
     # arguments are a string that must match the test name
@@ -36,11 +218,47 @@ class TestImageAlter < Test::Unit::TestCase
   def teardown
   end
 
+  # transform the case named c, which writes a PNG of size, with the
+  # native resampler and with GraphicsMagick's, and check the results
+  # are all but the same
+  def assertNearMagick(c, size)
+    f = File.join(File.dirname(__FILE__), "cases", c + ".json")
+    want = nil
+    BrowserPlus.run(@service, @providerDir) { |s|
+      want = runCase_private(s, f)
+    }
+    withNativeResize {
+      BrowserPlus.run(@service, @providerDir) { |s|
+        w, h, mean, worst = pngDifference(runCase_private(s, f), want)
+        assert_equal(size, [w, h])
+        assert(mean <= 0.5 && worst <= 4, "mean difference #{mean}, largest #{worst}")
+      }
+    }
+  end
+
   def test_load_service
     BrowserPlus.run(@service, @providerDir) { |s|
     }
   end
 
+  def test_anim_gif_animated
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # every frame is rotated and kept
+      f = File.join(File.dirname(__FILE__), "cases", "anim_gif_animated.json")
+      assert_equal(2, gifFrames(runCase_private(s, f)))
+      # without animated only the first is
+      json = JSON.parse(File.read(f))
+      json.delete("animated")
+      json["file"] = testFile(json["file"])
+      r = s.transform(json)
+      assert_equal(1, gifFrames(File.open(r["file"], "rb") { |oi| oi.read }))
+      # and a batch does the same
+      r = s.transformBatch({ "files" => [testFile("evil_turtle.gif")], "animated" => true,
+                             "actions" => json["actions"] })
+      assert_equal(2, gifFrames(File.open(r[0]["file"], "rb") { |oi| oi.read }))
+    }
+  end
+
   def test_anim_gif_to_jpg
     BrowserPlus.run(@service, @providerDir) { |s|
       f = File.join(File.dirname(__FILE__), "cases", "anim_gif_to_jpg.json")
@@ -76,6 +294,22 @@ class TestImageAlter < Test::Unit::TestCase
     }
   end
 
+  def test_crop_region_big
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # a leading crop of this 4.9 megapixel JPEG decodes just the
+      # region, which must hold exactly the pixels of a full decode.  A
+      # rotation first forces the full decode, and rotating the centered
+      # region selects the same pixels.
+      f = File.join(File.dirname(__FILE__), "cases", "crop_region_big.json")
+      got = runCase_private(s, f)
+      json = JSON.parse(File.read(f))
+      json["actions"] = json["actions"].reverse
+      json["file"] = "path:" + File.expand_path(File.join(File.dirname(__FILE__), "test_files", json["file"]))
+      r = s.transform(json)
+      assert_equal(File.open(r['file'], "rb") { |oi| oi.read }, got)
+    }
+  end
+
   def test_despeckle
     BrowserPlus.run(@service, @providerDir) { |s|
       f = File.join(File.dirname(__FILE__), "cases", "despeckle.json")
@@ -118,6 +352,90 @@ class TestImageAlter < Test::Unit::TestCase
     }
   end
 
+  def test_grayscale_cmyk
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # negated as CMYK, then converted to be made gray
+      f = File.join(File.dirname(__FILE__), "cases", "grayscale_cmyk.json")
+      assert_equal([150, 100, 1], jpegInfo(runCase_private(s, f)))
+    }
+  end
+
+  def test_grayscale_only
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # a gray image is written with a single channel
+      f = File.join(File.dirname(__FILE__), "cases", "grayscale_only.json")
+      assert_equal([500, 333, 1], jpegInfo(runCase_private(s, f)))
+    }
+  end
+
+  def test_grayscale_rec709
+    BrowserPlus.run(@service, @providerDir) { |s|
+      f = File.join(File.dirname(__FILE__), "cases", "grayscale_rec709.json")
+      got = runCase_private(s, f)
+      assert_equal([500, 333, 1], jpegInfo(got))
+      # the weights differ from the default rec601 ones
+      f = File.join(File.dirname(__FILE__), "cases", "grayscale_only.json")
+      assert_not_equal(runCase_private(s, f), got)
+    }
+  end
+
+  def test_grayscale_rec709_ramp
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # every gray level, white included, comes through unchanged
+      f = File.join(File.dirname(__FILE__), "cases", "grayscale_rec709_ramp.json")
+      want = pngPixels(File.binread(File.join(File.dirname(__FILE__), "test_files", "gray_ramp.png")))
+      assert_equal(want, pngPixels(runCase_private(s, f)))
+    }
+  end
+
+  def test_grayscale_to_png
+    BrowserPlus.run(@service, @providerDir) { |s|
+      f = File.join(File.dirname(__FILE__), "cases", "grayscale_to_png.json")
+      assert_equal(0, pngColorType(runCase_private(s, f)))
+    }
+  end
+
+  def test_info
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # each file is described as the case says, from its headers alone
+      json = JSON.parse(File.read(File.join(File.dirname(__FILE__), "cases", "info.json")))
+      json.each { |file, want|
+        got = s.info({ "file" => testFile(file) })
+        want.each { |k, v| assert_equal(v, got[k], "#{k} of #{file}") }
+      }
+      # the GIF has a transparent color
+      got = s.info({ "file" => testFile("evil_turtle.gif") })
+      assert_match(/^palette/, got["colorType"])
+    }
+  end
+
+  def test_native_scale_odd
+    # the native resampler stays close to GraphicsMagick's
+    assertNearMagick("native_scale_odd", [332, 223])
+  end
+
+  def test_native_scale_one_pixel
+    assertNearMagick("native_scale_one_pixel", [1, 1])
+  end
+
+  def test_native_thumbnail
+    # a large reduction is point sampled first, as GraphicsMagick does
+    assertNearMagick("native_thumbnail", [40, 26])
+  end
+
+  def test_native_weights_reused
+    withNativeResize {
+      BrowserPlus.run(@service, @providerDir) { |s|
+        # the weights kept from the first transform, with another size
+        # made in between, give the same result the second time
+        f = File.join(File.dirname(__FILE__), "cases", "native_scale_odd.json")
+        first = runCase_private(s, f)
+        runCase_private(s, File.join(File.dirname(__FILE__), "cases", "native_scale_one_pixel.json"))
+        assert_equal(first, runCase_private(s, f))
+      }
+    }
+  end
+
   def test_negate
     BrowserPlus.run(@service, @providerDir) { |s|
       f = File.join(File.dirname(__FILE__), "cases", "negate.json")
@@ -139,6 +457,14 @@ class TestImageAlter < Test::Unit::TestCase
     }
   end
 
+  def test_noop_anim_gif
+    BrowserPlus.run(@service, @providerDir) { |s|
+      f = File.join(File.dirname(__FILE__), "cases", "noop_anim_gif.json")
+      # like every action, noop keeps only the first frame
+      assert_equal(1, gifFrames(runCase_private(s, f)))
+    }
+  end
+
   def test_normalize
     BrowserPlus.run(@service, @providerDir) { |s|
       f = File.join(File.dirname(__FILE__), "cases", "normalize.json")
@@ -153,6 +479,106 @@ class TestImageAlter < Test::Unit::TestCase
     }
   end
 
+  # the optimized action lists must give exactly what the lists they
+  # reduce to give
+  def test_optimize_noops
+    BrowserPlus.run(@service, @providerDir) { |s|
+      f = File.join(File.dirname(__FILE__), "cases", "optimize_noops.json")
+      runTest_private(s, f, self, "crop")
+    }
+  end
+
+  def test_optimize_fold_rotations
+    BrowserPlus.run(@service, @providerDir) { |s|
+      f = File.join(File.dirname(__FILE__), "cases", "optimize_fold_rotations.json")
+      runTest_private(s, f, self, "rotate_180")
+    }
+  end
+
+  def test_optimize_cancel_rotations
+    BrowserPlus.run(@service, @providerDir) { |s|
+      f = File.join(File.dirname(__FILE__), "cases", "optimize_cancel_rotations.json")
+      runTest_private(s, f, self, "rotate_45")
+    }
+  end
+
+  def test_optimize_collapse_scaling
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # the second scale can't change the size, so it's dropped
+      f = File.join(File.dirname(__FILE__), "cases", "optimize_collapse_scaling.json")
+      runTest_private(s, f, self, "rotate_and_scale")
+    }
+  end
+
+  def test_optimize_mixed_scaling
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # the optimized list must give the size each resize in turn does.
+      # Every resize truncates, so the first three come out a pixel
+      # smaller than a single resize to the tighter bounds would.
+      [ [ ["thumbnail", 51], ["scale", 26] ],
+        [ ["scale", 50], ["thumbnail", 29] ],
+        [ ["thumbnail", 51], ["thumbnail", 26] ],
+        [ ["scale", 80], ["scale", 160] ] ].each { |seq|
+        actions = seq.map { |name, bound| { name => { "maxwidth" => bound, "maxheight" => bound } } }
+        want = seq.inject([500, 333]) { |(w, h), (name, bound)| scaledSize(w, h, bound, bound) }
+        r = s.transform({ "file" => testFile("cairo_sm.jpeg"), "actions" => actions })
+        got = File.open(r['file'], "rb") { |f| f.read }
+        assert_equal(want, jpegInfo(got)[0, 2], seq.inspect)
+      }
+    }
+  end
+
+  def test_optimize_shear_boundary
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # -90 then 45 shears by +45 degrees, a single -45 rotation by -45,
+      # so they mustn't be folded together
+      f = File.join(File.dirname(__FILE__), "cases", "optimize_shear_boundary.json")
+      got = runCase_private(s, f)
+      json = JSON.parse(File.read(f))
+      json["actions"] = [ { "rotate" => -45 } ]
+      json["file"] = "path:" + File.expand_path(File.join(File.dirname(__FILE__), "test_files", json["file"]))
+      r = s.transform(json)
+      assert_not_equal(File.open(r['file'], "rb") { |oi| oi.read }, got)
+    }
+  end
+
+  def test_optimize_full_turn_anim_gif
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # a full turn is optimized away, but must still drop all but the
+      # first frame
+      f = File.join(File.dirname(__FILE__), "cases", "optimize_full_turn_anim_gif.json")
+      assert_equal(1, gifFrames(runCase_private(s, f)))
+    }
+  end
+
+  def test_point_ops_cmyk
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # pixel operations on a CMYK image leave it CMYK
+      f = File.join(File.dirname(__FILE__), "cases", "point_ops_cmyk.json")
+      assert_equal([150, 100, 4], jpegInfo(runCase_private(s, f)))
+    }
+  end
+
+  def test_profile
+    BrowserPlus.run(@service, @providerDir) { |s|
+      json = JSON.parse(File.read(File.join(File.dirname(__FILE__), "cases", "profile.json")))
+      input = File.join(File.dirname(__FILE__), "test_files", json["file"])
+      json["file"] = testFile(json["file"])
+      r = s.transform(json)
+      p = r["profile"]
+      names = p["stages"].map { |stage| stage["name"] }
+      ["read", "decode", "scale", "write"].each { |name| assert(names.include?(name), name) }
+      assert(p["stages"].all? { |stage| stage["ms"] >= 0 })
+      assert_equal(File.size(input), p["bytesIn"])
+      assert_equal(File.size(r["file"]), p["bytesOut"])
+      # at least the decoded image was held in memory
+      assert(p["peakPixelBytes"] >= 500 * 333 * 4)
+      # and without profile there's none
+      json.delete("profile")
+      assert(!s.transform(json).key?("profile"))
+    }
+  end
+
   def test_psychedelic
     BrowserPlus.run(@service, @providerDir) { |s|
       f = File.join(File.dirname(__FILE__), "cases", "psychedelic.json")
@@ -160,6 +586,25 @@ class TestImageAlter < Test::Unit::TestCase
     }
   end
 
+  def test_renditions
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # small is shrunk from large, and rotated, the last made, is given
+      # the decoded image rather than a copy of it
+      json = JSON.parse(File.read(File.join(File.dirname(__FILE__), "cases", "renditions.json")))
+      json["file"] = testFile(json["file"])
+      r = s.renditions(json)
+      assert_equal(["large", "rotated", "small"], r.keys.sort)
+      { "large" => [600, 400], "small" => [100, 66], "rotated" => [1000, 1500] }.each { |name, size|
+        assert_equal(size + [1500, 1000], [r[name]["width"], r[name]["height"],
+                                           r[name]["orig_width"], r[name]["orig_height"]])
+      }
+      read = lambda { |name| File.open(r[name]["file"], "rb") { |oi| oi.read } }
+      assert_equal([600, 400, 3], jpegInfo(read.call("large")))
+      assert_equal(0, pngColorType(read.call("small")))
+      assert_equal([1000, 1500, 3], jpegInfo(read.call("rotated")))
+    }
+  end
+
   def test_rotate_180
     BrowserPlus.run(@service, @providerDir) { |s|
       f = File.join(File.dirname(__FILE__), "cases", "rotate_180.json")
@@ -202,6 +647,20 @@ class TestImageAlter < Test::Unit::TestCase
     }
   end
 
+  def test_scale_draft
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # with draft the JPEG is decoded at a quarter of its size, which
+      # gives a result of the same size but not the same pixels
+      f = File.join(File.dirname(__FILE__), "cases", "scale_draft.json")
+      got = runCase_private(s, f)
+      assert_equal([300, 200, 3], jpegInfo(got))
+      f = File.join(File.dirname(__FILE__), "cases", "scale_no_draft.json")
+      want = runCase_private(s, f)
+      assert_equal([300, 200, 3], jpegInfo(want))
+      assert_not_equal(want, got)
+    }
+  end
+
   def test_sepia
     BrowserPlus.run(@service, @providerDir) { |s|
       f = File.join(File.dirname(__FILE__), "cases", "sepia.json")
@@ -244,6 +703,16 @@ class TestImageAlter < Test::Unit::TestCase
     }
   end
 
+  def test_thumbnail_reduced_decode
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # with draft the JPEG is decoded at half size, no less than five
+      # times the result, which must still give a thumbnail of the
+      # requested size
+      f = File.join(File.dirname(__FILE__), "cases", "thumbnail_reduced_decode.json")
+      assert_equal([120, 80, 3], jpegInfo(runCase_private(s, f)))
+    }
+  end
+
   def test_thumbnail_and_rotate
     BrowserPlus.run(@service, @providerDir) { |s|
       f = File.join(File.dirname(__FILE__), "cases", "thumbnail_and_rotate.json")
@@ -265,6 +734,41 @@ class TestImageAlter < Test::Unit::TestCase
     }
   end
 
+  def test_trace
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # spans are recorded while it's on, and written as trace_event JSON
+      s.trace({ "enable" => true })
+      runCase_private(s, File.join(File.dirname(__FILE__), "cases", "rotate_180.json"))
+      r = s.trace({ "enable" => false })
+      events = JSON.parse(File.read(r["file"]))["traceEvents"]
+      names = events.map { |e| e["name"] }
+      ["transform", "read", "decode", "write"].each { |name| assert(names.include?(name), name) }
+      assert(events.all? { |e| e["ph"] == "X" && e["dur"] >= 0 })
+      # and not once it's off
+      runCase_private(s, File.join(File.dirname(__FILE__), "cases", "rotate_180.json"))
+      assert_equal(events.length, JSON.parse(File.read(s.trace({})["file"]))["traceEvents"].length)
+    }
+  end
+
+  def test_transform_batch
+    BrowserPlus.run(@service, @providerDir) { |s|
+      # a result for each file in order, an error for the one that can't
+      # be read, and the others just what transform makes of them
+      json = JSON.parse(File.read(File.join(File.dirname(__FILE__), "cases", "batch_scale.json")))
+      files = json["files"].map { |f| testFile(f) }
+      r = s.transformBatch(json.merge("files" => files))
+      assert_equal(3, r.length)
+      assert(r[1].key?("error"))
+      json.delete("files")
+      [[0, [100, 66]], [2, [100, 67]]].each { |i, size|
+        assert_equal(size, [r[i]["width"], r[i]["height"]])
+        want = s.transform(json.merge("file" => files[i]))
+        got = File.open(r[i]["file"], "rb") { |oi| oi.read }
+        assert_equal(File.open(want["file"], "rb") { |oi| oi.read }, got)
+      }
+    }
+  end
+
   def test_unsharpen
     BrowserPlus.run(@service, @providerDir) { |s|
       f = File.join(File.dirname(__FILE__), "cases", "unsharpen.json")